@@ -0,0 +1,76 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NAO_POS_SERVER__EXECUTION_STATS_HPP_
+#define NAO_POS_SERVER__EXECUTION_STATS_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "nao_pos_interfaces/action/pos_play.hpp"
+#include "nao_pos_server/perf_counters.hpp"
+
+namespace stats
+{
+
+// Counters of one goal execution, updated by the tick and turned into the execution report of
+// the PosPlay result. Everything is preallocated: recording never allocates.
+class ExecutionStats
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  using Result = nao_pos_interfaces::action::PosPlay::Result;
+
+  // Latency histogram resolution and range, slower ticks end up in the last bucket
+  static constexpr unsigned BUCKET_US = 10;
+  static constexpr std::size_t NUM_BUCKETS = 2000;
+
+  void reset(Clock::duration deadline);
+
+  // A tick that published a command, from sensor callback (start) to publish (end)
+  void recordTick(Clock::time_point start, Clock::time_point end);
+
+  // Compares the pose tracked at the previous tick (the command, or the motion without look-ahead)
+  // with the pose sensed now, and returns the largest error of this tick. commanded holds one
+  // value per entry of joints, sensed is indexed by joint index.
+  float recordTrackingError(
+    const uint8_t * joints, std::size_t numJoints, const float * commanded, const float * sensed);
+
+  // Hardware counters of a tick that published a command
+  void recordPerfCounters(const PerfCounters::Values & values);
+
+  void fillResult(Result & result) const;
+
+private:
+  Clock::duration deadline_{};
+  uint32_t ticks_ = 0;
+  uint32_t deadline_misses_ = 0;
+  Clock::time_point first_tick_{};
+  Clock::time_point last_tick_{};
+  Clock::duration max_latency_{};
+  std::array<uint32_t, NUM_BUCKETS> latency_histogram_{};
+
+  std::array<float, Result::NUM_GROUPS> max_error_{};
+  std::array<double, Result::NUM_GROUPS> sum_error_{};
+  std::array<uint32_t, Result::NUM_GROUPS> num_error_samples_{};
+
+  PerfCounters::Values sum_counters_{};
+  uint32_t counted_ticks_ = 0;
+};
+
+}  // namespace stats
+
+#endif  // NAO_POS_SERVER__EXECUTION_STATS_HPP_
@@ -0,0 +1,82 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef NAO_POS_SERVER__FIXED_MOTION_HPP_
+#define NAO_POS_SERVER__FIXED_MOTION_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "nao_pos_server/motion.hpp"
+
+namespace motion
+{
+
+// Integer-only variant of Motion: time is in integer microseconds, angles and stiffnesses are
+// fixed point int32 with FRACTION_BITS fractional bits. Evaluation uses no floating point at
+// all, so a given motion, start pose and time give bit-identical commands on any CPU, whatever
+// the compiler flags (FMA contraction, x87, fast-math).
+class FixedMotion
+{
+public:
+  // Q3.28: range [-8, 8), resolution 3.7e-9 rad
+  static constexpr int FRACTION_BITS = 28;
+
+  // Round to the nearest fixed point value, saturating outside the range
+  static int32_t toFixed(float value);
+  // Nearest float to the fixed point value, the same on every IEEE 754 CPU
+  static float toFloat(int32_t value);
+
+  static std::shared_ptr<const FixedMotion> fromMotion(const Motion & motion);
+
+  std::size_t numKeyFrames() const {return times_us_.size();}
+  std::size_t numJoints() const {return joints_.size();}
+  const std::vector<uint8_t> & joints() const {return joints_;}
+
+  int64_t timeUs(std::size_t k) const {return times_us_[k];}
+  const int32_t * positions(std::size_t k) const {return &positions_[k * joints_.size()];}
+  const int32_t * stiffnesses(std::size_t k) const {return &stiffnesses_[k * joints_.size()];}
+
+  int64_t durationUs() const {return times_us_.empty() ? 0 : times_us_.back();}
+  bool finished(int64_t time_us) const {return time_us >= durationUs();}
+
+  // Same semantics as Motion::segmentAt and Motion::segmentFrom
+  std::size_t segmentAt(int64_t time_us) const;
+  std::size_t segmentFrom(std::size_t hint, int64_t time_us) const;
+
+  // Linear interpolation inside the segment at time_us (clamped to the segment), computed as
+  // previous + (next - previous) * elapsed / duration in 64 bit integers. start holds the start
+  // pose, one fixed point value per joints() entry.
+  void interpolate(
+    std::size_t segment, int64_t time_us, const int32_t * start, int32_t * positions_out,
+    int32_t * stiffnesses_out) const;
+
+  // segmentAt + interpolate
+  void evaluate(
+    int64_t time_us, const int32_t * start, int32_t * positions_out,
+    int32_t * stiffnesses_out) const;
+
+private:
+  std::vector<uint8_t> joints_;
+  std::vector<int64_t> times_us_;
+  std::vector<int32_t> positions_;
+  std::vector<int32_t> stiffnesses_;
+};
+
+}  // namespace motion
+
+#endif  // NAO_POS_SERVER__FIXED_MOTION_HPP_
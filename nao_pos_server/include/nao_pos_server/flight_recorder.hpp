@@ -0,0 +1,116 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NAO_POS_SERVER__FLIGHT_RECORDER_HPP_
+#define NAO_POS_SERVER__FLIGHT_RECORDER_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace recorder
+{
+
+// What a record holds
+enum class Kind : uint8_t
+{
+  SensorPositions = 1,  // sensed angles of every joint
+  CommandPositions = 2,  // a published position command, possibly sparse
+  CommandStiffnesses = 3,
+  GoalAccepted = 4,  // see Sample::goalName
+  GoalCanceled = 5,
+};
+
+// One record as read back from a recorder file
+struct Sample
+{
+  static constexpr std::size_t MAX_JOINTS = 25;
+
+  int64_t stamp_ns;  // node clock
+  Kind kind;
+  uint8_t numJoints;
+  uint8_t joints[MAX_JOINTS];  // joint index of each value
+  float values[MAX_JOINTS];
+
+  // Goal records carry the goal instead of joint values: its name, numJoints bytes stored in
+  // values, and the start_time it requested (0 for as soon as possible), stored in joints
+  static constexpr std::size_t MAX_GOAL_NAME = sizeof(values);
+  std::string goalName() const;
+  int64_t goalStartNs() const;
+};
+
+// Always-on recorder of the last sensor samples, commands and goals of a server, in a ring of
+// fixed size records in a memory-mapped file. The file lives in the page cache, so it survives a
+// crash of the process and can be copied off the robot after a fall and read with readFile (or
+// nao_pos_flight_dump) while the server keeps running.
+// Recording takes no lock, makes no system call and never allocates: a writer reserves a slot
+// with an atomic increment, fills it, then publishes its sequence number. Any number of threads
+// can record concurrently. Readers skip the slots being written and the slots that a writer
+// lapped while they were read.
+class FlightRecorder
+{
+public:
+  // Maps path, holding capacity records. An existing recorder file with the same capacity is
+  // appended to, so the history before a restart of the server is kept, anything else is
+  // overwritten. nullptr if the file can not be created or mapped, errno tells why.
+  static std::unique_ptr<FlightRecorder> create(const std::string & path, std::size_t capacity);
+
+  ~FlightRecorder();
+  FlightRecorder(const FlightRecorder &) = delete;
+  FlightRecorder & operator=(const FlightRecorder &) = delete;
+
+  // Records values[i] for the joint joints[i], i < numJoints. Values of joints beyond
+  // Sample::MAX_JOINTS are dropped.
+  void record(
+    Kind kind, int64_t stamp_ns, const uint8_t * joints, const float * values,
+    std::size_t numJoints);
+  // Records values[j] for every joint j < numJoints
+  void record(Kind kind, int64_t stamp_ns, const float * values, std::size_t numJoints);
+  // Records a goal event. Names longer than Sample::MAX_GOAL_NAME are truncated.
+  void recordGoal(Kind kind, int64_t stamp_ns, const std::string & name, int64_t start_ns = 0);
+
+  std::size_t capacity() const {return capacity_;}
+  // Records written to the file so far, including the ones overwritten since
+  uint64_t numRecorded() const;
+
+  // Records still in the ring, oldest first
+  std::vector<Sample> snapshot() const;
+
+  // Records of a recorder file, oldest first. nullopt if the file is not a recorder file.
+  static std::optional<std::vector<Sample>> readFile(const std::string & path);
+
+private:
+  struct Header;
+  struct Slot;
+
+  FlightRecorder(void * mapping, std::size_t size, std::size_t capacity);
+  static std::vector<Sample> read(const Header & header, const Slot * slots);
+  // Reserves the slot of the next record, to be published by commit
+  Slot & reserve(uint64_t & n);
+  static void commit(Slot & slot, uint64_t n);
+
+  void * mapping_;
+  std::size_t size_;
+  std::size_t capacity_;
+  Header * header_;
+  Slot * slots_;
+};
+
+}  // namespace recorder
+
+#endif  // NAO_POS_SERVER__FLIGHT_RECORDER_HPP_
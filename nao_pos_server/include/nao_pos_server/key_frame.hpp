@@ -15,21 +15,40 @@
 #ifndef NAO_POS_SERVER__KEY_FRAME_HPP_
 #define NAO_POS_SERVER__KEY_FRAME_HPP_
 
+#include <cstdint>
+#include <utility>
+
 #include "nao_lola_command_msgs/msg/joint_positions.hpp"
 #include "nao_lola_command_msgs/msg/joint_stiffnesses.hpp"
 
+// Move-only: a keyframe goes from the parser to Motion::fromKeyFrames without being copied
 class KeyFrame
 {
 public:
-  KeyFrame(unsigned t_ms, const nao_lola_command_msgs::msg::JointPositions& positions,
-           const nao_lola_command_msgs::msg::JointStiffnesses& stiffnesses)
-    : t_ms(t_ms), positions(positions), stiffnesses(stiffnesses)
+  // Feet on the ground while moving to this keyframe, declared in pos files by "@ support" lines
+  enum class Support : uint8_t
+  {
+    None,  // not declared, or not standing (sitting, lying)
+    Double,
+    Left,
+    Right
+  };
+
+  KeyFrame(unsigned t_ms, nao_lola_command_msgs::msg::JointPositions&& positions,
+           nao_lola_command_msgs::msg::JointStiffnesses&& stiffnesses)
+    : t_ms(t_ms), positions(std::move(positions)), stiffnesses(std::move(stiffnesses))
   {
   }
 
+  KeyFrame(const KeyFrame&) = delete;
+  KeyFrame& operator=(const KeyFrame&) = delete;
+  KeyFrame(KeyFrame&&) = default;
+  KeyFrame& operator=(KeyFrame&&) = default;
+
   unsigned t_ms;
   nao_lola_command_msgs::msg::JointPositions positions;
   nao_lola_command_msgs::msg::JointStiffnesses stiffnesses;
+  Support support = Support::None;
 };
 
 #endif  // NAO_POS_SERVER__KEY_FRAME_HPP_
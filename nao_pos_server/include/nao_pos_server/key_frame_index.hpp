@@ -0,0 +1,96 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef NAO_POS_SERVER__KEY_FRAME_INDEX_HPP_
+#define NAO_POS_SERVER__KEY_FRAME_INDEX_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nao_pos_server/motion.hpp"
+
+namespace motion
+{
+
+// Spatial index over the keyframes of a set of motions, keyed by their joint angles: finds the
+// keyframe closest to a pose (e.g. the sensed one) without comparing it to every keyframe.
+// Motions actuating different joints do not share a space, so keyframes are grouped by joint set
+// with one k-d tree per group. Distances are RMS joint errors, comparable between groups.
+// Immutable once built, so it can be queried from any thread.
+class KeyFrameIndex
+{
+public:
+  struct Match
+  {
+    const std::string * name;
+    const Motion * motion;
+    std::size_t keyFrame;
+    float distance;  // RMS error over the joints of the motion, in rad
+  };
+
+  explicit KeyFrameIndex(
+    const std::vector<std::pair<std::string, std::shared_ptr<const Motion>>> & motions);
+
+  // Keyframe of motion closest to pose, nullopt if motion is not indexed or is empty.
+  // pose holds the angle of every joint, indexed by joint index (as in a sensor message).
+  std::optional<Match> nearest(const Motion & motion, const float * pose) const;
+  // Keyframe closest to pose over every indexed motion: the best motion to start from
+  std::optional<Match> nearest(const float * pose) const;
+
+  std::size_t numKeyFrames() const;
+
+private:
+  // k-d tree stored implicitly: the node of a range of points is its middle element, its
+  // children are the halves on each side
+  struct Tree
+  {
+    std::vector<uint8_t> joints;
+    std::vector<float> points;  // one row of joints.size() angles per keyframe, in tree order
+    std::vector<uint32_t> entries;  // index into entries_ of each point
+    std::vector<uint32_t> keyFrames;
+    std::vector<uint8_t> axes;  // split axis of each node
+
+    std::size_t dimension() const {return joints.size();}
+    std::size_t size() const {return keyFrames.size();}
+  };
+
+  struct Search
+  {
+    const float * query;
+    std::size_t entry;  // only points of this entry match, unless ANY_ENTRY
+    float bestDistance2;
+    std::size_t best;
+  };
+  static constexpr std::size_t ANY_ENTRY = static_cast<std::size_t>(-1);
+
+  static void build(
+    Tree & tree, const std::vector<float> & points, std::vector<uint32_t> & order,
+    std::size_t begin, std::size_t end);
+  static void search(const Tree & tree, std::size_t begin, std::size_t end, Search & search);
+  std::optional<Match> nearestIn(std::size_t tree, std::size_t entry, const float * pose) const;
+
+  std::vector<std::pair<std::string, std::shared_ptr<const Motion>>> entries_;
+  std::vector<std::size_t> treeOf_;  // tree holding the keyframes of each entry
+  std::vector<Tree> trees_;
+};
+
+}  // namespace motion
+
+#endif  // NAO_POS_SERVER__KEY_FRAME_INDEX_HPP_
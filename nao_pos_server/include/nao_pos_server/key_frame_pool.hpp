@@ -0,0 +1,73 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef NAO_POS_SERVER__KEY_FRAME_POOL_HPP_
+#define NAO_POS_SERVER__KEY_FRAME_POOL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <unordered_map>
+
+namespace motion
+{
+
+// Content-addressed storage of keyframe rows (the positions, or the stiffnesses, of the joints of
+// one keyframe). Rows are hashed after quantization to QUANTUM: a row equal to one already in the
+// pool, at that resolution, is not stored again and the stored one is shared. Motions sharing a
+// pool share their common rows, e.g. the head file families, the getups and the goalie motions.
+// Rows are reference counted: each intern takes a reference, released by release, and a row is
+// freed with its last reference, so the pool only holds the rows of the motions alive. Freed
+// blocks are reused for the next rows. Motions using the pool keep it alive. Thread safe.
+class KeyFramePool
+{
+public:
+  static constexpr float QUANTUM = 1e-6f;
+
+  explicit KeyFramePool(std::pmr::memory_resource * upstream = std::pmr::get_default_resource());
+  KeyFramePool(const KeyFramePool &) = delete;
+  KeyFramePool & operator=(const KeyFramePool &) = delete;
+
+  // The stored row equal to row, which is added if there is none, with one more reference
+  const float * intern(const float * row, std::size_t size);
+  // Drops a reference taken by intern on the stored row
+  void release(const float * row, std::size_t size);
+
+  std::size_t numRows() const;  // distinct rows stored
+  std::size_t numInterned() const;  // rows requested
+  std::size_t storedValues() const;
+
+private:
+  struct Row
+  {
+    float * values;
+    std::size_t size;
+    std::size_t references;
+  };
+
+  static int64_t quantize(float value);
+  static std::size_t hash(const float * row, std::size_t size);
+
+  std::pmr::unsynchronized_pool_resource memory_;
+  std::unordered_multimap<std::size_t, Row> rows_;
+  std::size_t numInterned_ = 0;
+  std::size_t storedValues_ = 0;
+  mutable std::mutex mutex_;
+};
+
+}  // namespace motion
+
+#endif  // NAO_POS_SERVER__KEY_FRAME_POOL_HPP_
@@ -0,0 +1,115 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef NAO_POS_SERVER__KINEMATICS_HPP_
+#define NAO_POS_SERVER__KINEMATICS_HPP_
+
+#include <cstddef>
+#include <vector>
+
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+#include "nao_pos_server/motion.hpp"
+
+// Forward kinematics of the NAO v6, for the checks run on motions when they are loaded.
+// Lengths are in mm, in the torso frame: x forward, y left, z up, origin at the torso center.
+namespace kinematics
+{
+
+constexpr std::size_t NUM_JOINTS = nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS;
+
+struct Vec3
+{
+  float x;
+  float y;
+  float z;
+};
+
+// Rigid transform: rotation (3x3, row major) followed by a translation
+struct Frame
+{
+  float rotation[9];
+  Vec3 position;
+
+  Vec3 transform(const Vec3 & point) const
+  {
+    return {
+      rotation[0] * point.x + rotation[1] * point.y + rotation[2] * point.z + position.x,
+      rotation[3] * point.x + rotation[4] * point.y + rotation[5] * point.z + position.y,
+      rotation[6] * point.x + rotation[7] * point.y + rotation[8] * point.z + position.z};
+  }
+
+  // Coordinates in this frame of a point given in the parent frame
+  Vec3 inverseTransform(const Vec3 & point) const
+  {
+    const Vec3 d{point.x - position.x, point.y - position.y, point.z - position.z};
+    return {
+      rotation[0] * d.x + rotation[3] * d.y + rotation[6] * d.z,
+      rotation[1] * d.x + rotation[4] * d.y + rotation[7] * d.z,
+      rotation[2] * d.x + rotation[5] * d.y + rotation[8] * d.z};
+  }
+};
+
+// Frame of each limb link, with the origin on the joint that moves it
+struct Body
+{
+  Frame lUpperArm;  // shoulder, after LShoulderRoll
+  Frame lForeArm;   // elbow, after LElbowRoll
+  Frame rUpperArm;
+  Frame rForeArm;
+  Frame lThigh;     // hip, after LHipPitch
+  Frame lTibia;     // knee, after LKneePitch
+  Frame lFoot;      // ankle, after LAnkleRoll
+  Frame rThigh;
+  Frame rTibia;
+  Frame rFoot;
+};
+
+// Link offsets, from the NAO v6 documentation
+constexpr Vec3 L_SHOULDER_OFFSET{0.0f, 98.0f, 100.0f};
+constexpr Vec3 L_ELBOW_OFFSET{105.0f, 15.0f, 0.0f};
+constexpr Vec3 R_SHOULDER_OFFSET{0.0f, -98.0f, 100.0f};
+constexpr Vec3 R_ELBOW_OFFSET{105.0f, -15.0f, 0.0f};
+constexpr float HAND_LENGTH = 55.95f + 57.75f;  // elbow to wrist to hand
+constexpr Vec3 L_HIP_OFFSET{0.0f, 50.0f, -85.0f};
+constexpr Vec3 R_HIP_OFFSET{0.0f, -50.0f, -85.0f};
+constexpr float THIGH_LENGTH = 100.0f;
+constexpr float TIBIA_LENGTH = 102.9f;
+constexpr float FOOT_HEIGHT = 45.19f;  // ankle to sole
+// Sole of each foot, in its foot frame
+constexpr float SOLE_FRONT = 100.0f;
+constexpr float SOLE_BACK = -55.0f;
+constexpr float SOLE_HALF_WIDTH = 45.0f;
+
+// Computes the body of numPoses poses. Each pose is a row of NUM_JOINTS angles in radians,
+// indexed by joint index (the right hip uses LHipYawPitch, the two are one motor).
+void forwardKinematics(const float * poses, std::size_t numPoses, Body * bodies_out);
+
+// Center of mass of the whole robot, in the torso frame. The head is counted as part of the
+// torso, its joints move the center of mass by less than a millimeter.
+Vec3 centerOfMass(const Body & body);
+
+// Pose assumed for the joints a motion does not actuate: standing straight, arms along the body
+const float * neutralPose();
+
+// Samples motion at every keyframe and every period_ms between keyframes, from the first
+// keyframe on (before it the motion depends on the pose the robot starts from). Writes the
+// sample times and one full pose (see forwardKinematics) per sample.
+void samplePoses(
+  const motion::Motion & motion, float period_ms, std::vector<float> & times_ms_out,
+  std::vector<float> & poses_out);
+
+}  // namespace kinematics
+
+#endif  // NAO_POS_SERVER__KINEMATICS_HPP_
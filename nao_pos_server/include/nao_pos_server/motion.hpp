@@ -0,0 +1,176 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NAO_POS_SERVER__MOTION_HPP_
+#define NAO_POS_SERVER__MOTION_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <vector>
+
+#include "nao_pos_server/key_frame.hpp"
+#include "nao_pos_server/key_frame_pool.hpp"
+
+namespace motion
+{
+
+// Read-only view over a contiguous array
+template<typename T>
+class ArrayView
+{
+public:
+  constexpr ArrayView(const T * data, std::size_t size)
+  : data_(data), size_(size) {}
+
+  constexpr std::size_t size() const {return size_;}
+  constexpr bool empty() const {return size_ == 0;}
+  constexpr const T * data() const {return data_;}
+  constexpr const T * begin() const {return data_;}
+  constexpr const T * end() const {return data_ + size_;}
+  constexpr const T & operator[](std::size_t i) const {return data_[i];}
+  const T & at(std::size_t i) const
+  {
+    if (i >= size_) {
+      throw std::out_of_range("ArrayView::at");
+    }
+    return data_[i];
+  }
+
+private:
+  const T * data_;
+  std::size_t size_;
+};
+
+// Dense, immutable representation of a parsed pos file.
+// Keyframes are stored as structure of arrays: one row of numJoints() values per keyframe,
+// where column j always refers to the joint joints()[j]. Once built, a Motion is never
+// modified, so it can be shared between every playback (and every robot) using it.
+// A motion built from keyframes keeps its data in a single monotonic arena owned by the motion,
+// allocated from the given upstream resource in one block and released in one shot with the
+// motion. A motion can also be a view over tables with static storage duration (the motions
+// embedded at build time by nao_pos_embed), which costs no allocation at all.
+// Keyframe rows are reached through one pointer per keyframe, so that motions built with a
+// KeyFramePool can share their identical rows instead of storing them in their arena.
+class Motion
+{
+public:
+  // Dense tables of a motion, the layout of the accessors below
+  struct Tables
+  {
+    const uint8_t * joints;
+    std::size_t numJoints;
+    const unsigned * times_ms;
+    std::size_t numKeyFrames;
+    const float * const * positionRows;  // numJoints() values per keyframe
+    const float * const * stiffnessRows;
+    const uint8_t * holds;  // one flag per segment
+    const KeyFrame::Support * supports;  // one per segment
+  };
+
+  // With a pool, the rows are interned in it instead of being copied in the arena of the motion,
+  // which keeps the pool alive and holds a reference on its rows until it is destroyed
+  static std::shared_ptr<const Motion> fromKeyFrames(
+    const std::vector<KeyFrame> & keyFrames,
+    std::pmr::memory_resource * upstream = std::pmr::get_default_resource(),
+    std::shared_ptr<KeyFramePool> pool = nullptr);
+
+  // View over tables that outlive the motion, nothing is copied
+  explicit Motion(const Tables & tables);
+  // Releases the rows interned in the pool
+  ~Motion();
+  Motion(const Motion &) = delete;
+  Motion & operator=(const Motion &) = delete;
+
+  const Tables & tables() const {return tables_;}
+
+  std::size_t numKeyFrames() const {return tables_.numKeyFrames;}
+  std::size_t numJoints() const {return tables_.numJoints;}
+  ArrayView<uint8_t> joints() const {return {tables_.joints, tables_.numJoints};}
+
+  unsigned timeMs(std::size_t k) const {return tables_.times_ms[k];}
+  const float * positions(std::size_t k) const {return tables_.positionRows[k];}
+  const float * stiffnesses(std::size_t k) const {return tables_.stiffnessRows[k];}
+
+  // Time at which the last keyframe is reached, 0 for an empty motion
+  unsigned durationMs() const
+  {
+    return numKeyFrames() == 0 ? 0 : tables_.times_ms[numKeyFrames() - 1];
+  }
+  bool finished(float time_ms) const {return time_ms >= durationMs();}
+
+  // Index of the keyframe the motion is heading to at time_ms, i.e. the first keyframe whose
+  // time is strictly greater than time_ms. The previous keyframe is segment - 1, or the start
+  // pose captured from the robot (at t = 0) when segment is 0. Past the end of the motion this
+  // is the last segment, whose beta saturates at 1, so evaluating holds the last keyframe.
+  // Not valid for an empty motion.
+  std::size_t segmentAt(float time_ms) const;
+  // Same as segmentAt, but starts searching from a segment known not to be in the future
+  // (e.g. the one found in the previous tick), so sequential playback is O(1) per tick.
+  std::size_t segmentFrom(std::size_t hint, float time_ms) const;
+
+  // A hold segment goes from a keyframe to an identical one: evaluating anywhere inside it gives
+  // positions(segment) and stiffnesses(segment). Segment 0 starts from the sensed pose, so it is
+  // never a hold.
+  bool isHold(std::size_t segment) const {return tables_.holds[segment] != 0;}
+
+  // Feet on the ground during the segment, as declared in the pos file
+  KeyFrame::Support support(std::size_t segment) const {return tables_.supports[segment];}
+
+  // Interpolation weight of the next keyframe inside the given segment, in [0, 1]
+  float beta(std::size_t segment, float time_ms) const;
+
+  // Convex combination of the two keyframes delimiting the segment. start holds the start pose,
+  // one value per joints() entry. positions_out and stiffnesses_out must hold numJoints() values.
+  // Stiffness is not interpolated, the one of the next keyframe is applied for the whole segment.
+  void interpolate(
+    std::size_t segment, float beta, const float * start, float * positions_out,
+    float * stiffnesses_out) const;
+
+  // segmentAt + beta + interpolate
+  void evaluate(
+    float time_ms, const float * start, float * positions_out, float * stiffnesses_out) const;
+
+  // Evaluates the motion at numTimes timestamps in one call, writing one row of numJoints()
+  // values per timestamp. Timestamps are meant to be sorted, then the segment search costs
+  // O(1) per sample; an out of order timestamp falls back to a binary search.
+  void evaluateBatch(
+    const float * times_ms, std::size_t numTimes, const float * start, float * positions_out,
+    float * stiffnesses_out) const;
+
+private:
+  Motion(std::pmr::memory_resource * upstream, std::size_t arenaSize);
+
+  // Points either into the vectors below or into static tables
+  Tables tables_;
+
+  // Storage of a motion built from keyframes, empty for a view.
+  // The arena is declared first: the vectors allocate from it, so it must outlive them.
+  std::unique_ptr<std::pmr::monotonic_buffer_resource> arena_;
+  std::pmr::vector<uint8_t> joints_;
+  std::pmr::vector<unsigned> times_ms_;
+  std::pmr::vector<float> positions_;  // rows, empty with a pool
+  std::pmr::vector<float> stiffnesses_;
+  std::pmr::vector<const float *> position_rows_;
+  std::pmr::vector<const float *> stiffness_rows_;
+  std::pmr::vector<uint8_t> holds_;
+  std::pmr::vector<KeyFrame::Support> supports_;
+  std::shared_ptr<KeyFramePool> pool_;
+};
+
+}  // namespace motion
+
+#endif  // NAO_POS_SERVER__MOTION_HPP_
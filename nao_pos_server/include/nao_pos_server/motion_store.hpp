@@ -0,0 +1,118 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NAO_POS_SERVER__MOTION_STORE_HPP_
+#define NAO_POS_SERVER__MOTION_STORE_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "nao_pos_server/key_frame_index.hpp"
+#include "nao_pos_server/key_frame_pool.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "nao_pos_server/stability.hpp"
+
+namespace motion
+{
+
+// Loads pos files by name and keeps the parsed motions around, so that a motion requested
+// again (by the same server or by another robot hosted in the same process) costs no parsing
+// while its file is unchanged. Thread safe.
+// Each motion keeps its data in its own arena allocated from upstream. A motion is evicted when
+// its file changes or by evict, and its arena is released in one shot when the last goal playing
+// it drops it. Keyframe rows are interned in a KeyFramePool shared by all the motions of the
+// store, also allocated from upstream, so the rows repeated across pos files are stored once;
+// the rows only used by an evicted motion are released from the pool along with its arena.
+// Parsing scratch memory is released after loading.
+class MotionStore
+{
+public:
+  // pos_directory defaults to the pos/ folder installed in the package share directory. Logs the
+  // embedded motions that shadow a file of pos_directory.
+  explicit MotionStore(
+    const std::string & pos_directory = defaultPosDirectory(),
+    std::pmr::memory_resource * upstream = std::pmr::get_default_resource());
+
+  // Returns the motion stored in <pos_directory>/<name>.pos, or nullptr if the file can not be
+  // opened or parsed. Failures are not cached, so a fixed file is picked up on the next request.
+  // A loaded motion is returned again while the modification time and size of its file are
+  // unchanged, otherwise it is evicted and the file parsed again.
+  // Motions embedded at build time are returned first, without any I/O or allocation.
+  std::shared_ptr<const Motion> load(const std::string & name);
+
+  // The motion embedded or already loaded under this name, without any I/O, nullptr if there is
+  // none. For the playback thread, which must not wait on the file system.
+  std::shared_ptr<const Motion> findLoaded(const std::string & name);
+
+  // Drops the motion loaded from <name>.pos and its stability analysis, the next load parses
+  // the file again. Goals playing it keep it until they end.
+  void evict(const std::string & name);
+
+  // When enabled, motions loaded from files go through the self collision precheck (see
+  // self_collision.hpp) and every contact found is logged as a warning. Embedded motions are
+  // checked by nao_pos_embed at build time instead.
+  void setSelfCollisionCheck(bool enabled) {check_self_collision_ = enabled;}
+  // When enabled, motions loaded from files are analyzed as by stability(name) and each segment
+  // that is not stable is logged as a warning
+  void setStabilityCheck(bool enabled) {check_stability_ = enabled;}
+
+  // Stability analysis of the motion (see stability.hpp), computed once and cached with the
+  // motion, so the durations of its segments can be shrunk safely down to min_duration_ms.
+  // nullptr if the motion can not be loaded.
+  std::shared_ptr<const std::vector<stability::Segment>> stability(const std::string & name);
+
+  // Index over the keyframes of the embedded motions and of every motion loaded so far, built on
+  // the first call after a new motion was loaded. Load the motions to query beforehand.
+  std::shared_ptr<const KeyFrameIndex> keyFrameIndex();
+
+  // Keyframe rows of the loaded motions
+  const KeyFramePool & pool() const {return *pool_;}
+
+  // The motion embedded at build time under this name, nullptr if there is none
+  static std::shared_ptr<const Motion> findEmbedded(const std::string & name);
+
+  static std::string defaultPosDirectory();
+
+private:
+  // A motion loaded from a file, with the version of the file it was parsed from
+  struct Loaded
+  {
+    std::shared_ptr<const Motion> motion;
+    int64_t mtime_ns;
+    int64_t size;
+  };
+
+  std::string getFullFilePath(const std::string & filename) const;
+  void evictLocked(const std::string & name);
+
+  std::string pos_directory_;
+  std::pmr::memory_resource * upstream_;
+  std::shared_ptr<KeyFramePool> pool_;
+  bool check_self_collision_ = false;
+  bool check_stability_ = false;
+  std::unordered_map<std::string, Loaded> motions_;
+  std::unordered_map<std::string, std::shared_ptr<const std::vector<stability::Segment>>>
+  stability_;
+  std::shared_ptr<const KeyFrameIndex> key_frame_index_;
+  std::mutex mutex_;
+};
+
+}  // namespace motion
+
+#endif  // NAO_POS_SERVER__MOTION_STORE_HPP_
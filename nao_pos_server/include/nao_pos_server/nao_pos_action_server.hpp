@@ -15,13 +15,16 @@
 #ifndef NAO_POS_SERVER__NAO_POS_ACTION_SERVER_HPP_
 #define NAO_POS_SERVER__NAO_POS_ACTION_SERVER_HPP_
 
+#include <condition_variable>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "rclcpp/node.hpp"
 #include "rclcpp/time.hpp"
+#include "rclcpp/wait_set.hpp"
 #include "rclcpp_action/rclcpp_action.hpp"
 
 #include "nao_lola_command_msgs/msg/joint_positions.hpp"
@@ -30,7 +33,18 @@
 #include "nao_lola_sensor_msgs/msg/joint_positions.hpp"
 
 #include "nao_pos_interfaces/action/pos_play.hpp"
-#include "nao_pos_server/key_frame.hpp"
+#include "nao_pos_server/execution_stats.hpp"
+#include "nao_pos_server/flight_recorder.hpp"
+#include "nao_pos_server/key_frame_index.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "nao_pos_server/motion_store.hpp"
+
+namespace script
+{
+class Script;
+struct Player;
+struct Entry;
+}  // namespace script
 
 namespace nao_pos_action_server_ns
 {
@@ -41,15 +55,54 @@ public:
   explicit NaoPosActionServer(const rclcpp::NodeOptions& options = rclcpp::NodeOptions{});
   virtual ~NaoPosActionServer();
 
+  // Ticks with a sensor sample as if it was received by the subscription, at the time of the
+  // node clock. Used to replay recordings (see nao_pos_replay).
+  void processSample(nao_lola_sensor_msgs::msg::JointPositions& sensor_joints);
+
 private:
-  std::string getFullFilePath(std::string& filename);
-  std::vector<std::string> readLines(std::ifstream& ifstream);
-  void calculateEffectorJoints(nao_lola_sensor_msgs::msg::JointPositions& sensor_joints);
-  const KeyFrame& findPreviousKeyFrame(int time_ms);
-  const KeyFrame& findNextKeyFrame(int time_ms);
-  bool posFinished(int time_ms);
-  void readPosFile(std::string& filePath);
-  float findElem(const std::vector<uint8_t>& indexes, const std::vector<float>& data, uint8_t joint);
+  void waitSetLoop();
+  void eventLoop();
+  void onJointPositions(nao_lola_sensor_msgs::msg::JointPositions& sensor_joints,
+                        const rclcpp::MessageInfo& message_info);
+  // Time the sample was received, on the stats clock
+  stats::ExecutionStats::Clock::time_point sampleReceivedTime(const rclcpp::MessageInfo& message_info);
+  void calculateEffectorJoints(nao_lola_sensor_msgs::msg::JointPositions& sensor_joints, const rclcpp::Time& now,
+                               stats::ExecutionStats::Clock::time_point tick_start);
+  // Playback state of a motion that stays the same while it plays, built when the goal is
+  // accepted so that starting the motion from the tick only switches pointers
+  struct PreparedMotion
+  {
+    std::string name;
+    std::shared_ptr<const motion::Motion> motion;
+    // Commands of the hold segments, indexed by segment (empty for the other segments)
+    std::vector<nao_lola_command_msgs::msg::JointPositions> hold_positions;
+    std::vector<nao_lola_command_msgs::msg::JointStiffnesses> hold_stiffnesses;
+  };
+  static PreparedMotion prepareMotion(const std::string& name, std::shared_ptr<const motion::Motion> motion);
+  // Starts the playback of a prepared motion from its first tick. Does not allocate: the buffers
+  // it sizes are reserved for every joint by the constructor.
+  void startMotion(const PreparedMotion& prepared);
+  // Timeline position to start the motion from: the time of its keyframe nearest to the sensed
+  // pose when resume.max_distance allows it, 0 otherwise
+  float resumeTimeMs(const nao_lola_sensor_msgs::msg::JointPositions& sensor_joints);
+  // Points tracked_positions_ to the pose of the motion at time_ms, the tick time without the
+  // look-ahead, which the joints should have reached by the next tick
+  void trackUnshiftedPose(float time_ms, float evaluation_ms);
+  // Max error between the tracked pose of the last tick and the sensed pose, over the commanded
+  // joints
+  float commandError(const nao_lola_sensor_msgs::msg::JointPositions& sensor_joints) const;
+  // Script requested by a "script/<name>" goal, nullptr for any other goal
+  static const script::Entry* findScript(const std::string& action_name);
+  // Publishes the command of the tick, or only its changes with output.delta_epsilon
+  void publishCommand(const nao_lola_command_msgs::msg::JointPositions& positions,
+                      const nao_lola_command_msgs::msg::JointStiffnesses& stiffnesses);
+  // Publish one message and record it in the flight recorder
+  void publishPositions(const nao_lola_command_msgs::msg::JointPositions& msg);
+  void publishStiffnesses(const nao_lola_command_msgs::msg::JointStiffnesses& msg);
+  // Adapts time_scale_ to the tracking error of the tick, returns false if the goal must abort
+  bool superviseTracking(float tracking_error);
+  // Updates delivery_latency_ms_ from the source timestamp of a sensor sample
+  void measureDeliveryLatency(const rclcpp::MessageInfo& message_info);
 
   rclcpp_action::GoalResponse handleGoal(const rclcpp_action::GoalUUID& uuid,
                                          std::shared_ptr<const nao_pos_interfaces::action::PosPlay::Goal> goal);
@@ -58,21 +111,89 @@ private:
   void handleAccepted(
       const std::shared_ptr<rclcpp_action::ServerGoalHandle<nao_pos_interfaces::action::PosPlay>> goal_handle);
 
+  std::string tick_mode_;
+  rclcpp::CallbackGroup::SharedPtr sensor_callback_group_;
+  std::thread tick_thread_;
+  std::atomic<bool> tick_thread_running_{true};
+  std::mutex new_samples_mutex_;
+  std::condition_variable new_samples_cv_;
+  std::size_t new_samples_ = 0;  // signaled by the new message listener in event tick_mode
+
   rclcpp::Subscription<nao_lola_sensor_msgs::msg::JointPositions>::SharedPtr sub_joint_states_;
   rclcpp::Publisher<nao_lola_command_msgs::msg::JointPositions>::SharedPtr pub_joint_positions_;
   rclcpp::Publisher<nao_lola_command_msgs::msg::JointStiffnesses>::SharedPtr pub_joint_stiffnesses_;
 
   rclcpp_action::Server<nao_pos_interfaces::action::PosPlay>::SharedPtr action_server_;
 
-  bool file_successfully_read_ = false;
-  std::vector<KeyFrame> key_frames_;
+  std::shared_ptr<motion::MotionStore> motion_store_;
+  std::shared_ptr<const motion::Motion> motion_;
   std::atomic<bool> pos_in_action_;
+  bool motion_finished_ = true;
   bool firstTickSinceActionStarted_ = true;
-  std::unique_ptr<KeyFrame> key_frame_start_;
+  std::vector<float> start_positions_;  // sensed pose of the motion joints at the first tick
+  std::size_t segment_ = 0;
   rclcpp::Time initial_time_;
-  std::vector<uint8_t> selected_joints_;
+  rclcpp::Time last_tick_time_;
+  rclcpp::Time tick_time_;  // time of the running tick
+  float timeline_ms_ = 0.0f;  // position in the motion, slower than the clock while slowing down
+  double tick_deadline_ms_;
+  stats::ExecutionStats stats_;
+  std::unique_ptr<stats::PerfCounters> perf_counters_;  // only with the perf_counters parameter
+
+  // Latency compensation
+  static constexpr float MAX_DELIVERY_LATENCY_MS = 50.0f;
+  static constexpr float DELIVERY_LATENCY_SMOOTHING = 0.05f;
+  double lookahead_pipeline_latency_ms_;
+  bool lookahead_delivery_latency_;
+  float delivery_latency_ms_ = 0.0f;  // exponential moving average
+
+  // Tracking supervision
+  double tracking_slowdown_error_;
+  double tracking_min_time_scale_;
+  double tracking_abort_error_;
+  int tracking_abort_ticks_;
+  float time_scale_ = 1.0f;
+  float previous_tracking_error_ = 0.0f;
+  int growing_error_ticks_ = 0;
+
+  // Motions the current goal may play, its script motions in order or the goal motion
+  std::vector<PreparedMotion> prepared_motions_;
+  const PreparedMotion* playing_ = nullptr;  // in prepared_motions_, motion_ is its motion
+
+  // Command messages are sized when a motion starts and refilled in place at every tick
+  nao_lola_command_msgs::msg::JointPositions effector_joints_;
+  nao_lola_command_msgs::msg::JointStiffnesses effector_joints_stiff_;
+  const nao_lola_command_msgs::msg::JointPositions* last_command_ = &effector_joints_;  // last published
+  // Pose the sensed pose is compared with at the next tick, one value per joint of last_command_:
+  // the last command itself, or the motion without look-ahead (see trackUnshiftedPose)
+  const float* tracked_positions_ = nullptr;
+  std::vector<float> unshifted_positions_;
+  std::vector<float> unshifted_stiffnesses_;  // evaluated along, unused
+  std::size_t tracked_segment_ = 0;
+
+  // Resuming interrupted motions
+  double resume_max_distance_;
+  std::shared_ptr<const motion::KeyFrameIndex> key_frame_index_;  // set for goals that may resume
+
+  // Sparse output
+  double output_delta_epsilon_;
+  int output_full_refresh_ticks_;
+  int ticks_since_full_command_ = 0;
+  std::vector<float> published_positions_;  // last value sent for every motion joint
+  std::vector<float> published_stiffnesses_;
+  nao_lola_command_msgs::msg::JointPositions delta_joints_;
+  nao_lola_command_msgs::msg::JointStiffnesses delta_joints_stiff_;
+
+  // Script run by the current goal, resumed by the tick (see script.hpp)
+  std::unique_ptr<script::Script> script_;
+  std::unique_ptr<script::Player> script_player_;
+  float script_tracking_error_ = 0.0f;
 
   std::shared_ptr<rclcpp_action::ServerGoalHandle<nao_pos_interfaces::action::PosPlay>> goal_handle_;
+  bool cancel_requested_ = false;  // accepted by handleCancel, completed by the next tick
+
+  // Last sensor samples and published commands, nullptr if disabled or not available
+  std::unique_ptr<recorder::FlightRecorder> recorder_;
 
   std::mutex mutex_;
 };
@@ -0,0 +1,108 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NAO_POS_SERVER__NAO_POS_FLEET_SERVER_HPP_
+#define NAO_POS_SERVER__NAO_POS_FLEET_SERVER_HPP_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rclcpp/node.hpp"
+#include "rclcpp/time.hpp"
+#include "rclcpp_action/rclcpp_action.hpp"
+
+#include "nao_lola_command_msgs/msg/joint_positions.hpp"
+#include "nao_lola_command_msgs/msg/joint_stiffnesses.hpp"
+#include "nao_lola_sensor_msgs/msg/joint_positions.hpp"
+
+#include "nao_pos_interfaces/action/pos_play.hpp"
+#include "nao_pos_server/execution_stats.hpp"
+#include "nao_pos_server/fixed_motion.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "nao_pos_server/motion_store.hpp"
+
+namespace nao_pos_fleet_server_ns
+{
+
+// Hosts the pos action server of several robots (one per namespace in the robot_namespaces
+// parameter) in a single node, meant for simulation. All robots share one MotionStore, and a
+// timer evaluates the active playbacks of the whole fleet in one batched pass per tick.
+class NaoPosFleetServer : public rclcpp::Node
+{
+public:
+  explicit NaoPosFleetServer(const rclcpp::NodeOptions& options = rclcpp::NodeOptions{});
+  virtual ~NaoPosFleetServer();
+
+private:
+  using PosPlay = nao_pos_interfaces::action::PosPlay;
+  using GoalHandlePosPlay = rclcpp_action::ServerGoalHandle<PosPlay>;
+
+  // ROS endpoints of one robot of the fleet
+  struct Robot
+  {
+    std::string ns;
+    rclcpp::Subscription<nao_lola_sensor_msgs::msg::JointPositions>::SharedPtr sub_joint_states;
+    rclcpp::Publisher<nao_lola_command_msgs::msg::JointPositions>::SharedPtr pub_joint_positions;
+    rclcpp::Publisher<nao_lola_command_msgs::msg::JointStiffnesses>::SharedPtr pub_joint_stiffnesses;
+    rclcpp_action::Server<PosPlay>::SharedPtr action_server;
+    std::shared_ptr<GoalHandlePosPlay> goal_handle;
+    nao_lola_command_msgs::msg::JointPositions effector_joints;
+    nao_lola_command_msgs::msg::JointStiffnesses effector_joints_stiff;
+  };
+
+  void addRobot(const std::string& ns);
+  void tick();
+  void finish(std::size_t r, bool success);
+
+  rclcpp_action::GoalResponse handleGoal(std::size_t r, std::shared_ptr<const PosPlay::Goal> goal);
+  rclcpp_action::CancelResponse handleCancel(std::size_t r);
+  void handleAccepted(std::size_t r, const std::shared_ptr<GoalHandlePosPlay> goal_handle);
+
+  std::shared_ptr<motion::MotionStore> motion_store_;
+  std::vector<Robot> robots_;
+  rclcpp::TimerBase::SharedPtr timer_;
+
+  // Playback state of the fleet, structure of arrays indexed by robot. Per-joint arrays hold
+  // NUMJOINTS values per robot, contiguous, so a tick walks them linearly.
+  std::vector<std::shared_ptr<const motion::Motion>> motions_;
+  std::vector<uint8_t> active_;
+  std::vector<uint8_t> first_tick_;
+  std::vector<uint8_t> sensed_;
+  std::vector<rclcpp::Time> initial_times_;
+  std::vector<int64_t> times_us_;
+  std::vector<float> times_ms_;
+  std::vector<std::size_t> segments_;
+  std::vector<float> betas_;
+  std::vector<stats::ExecutionStats> stats_;  // execution report of the goal of each robot
+  double tick_deadline_ms_;
+  std::vector<float> sensor_positions_;  // latest sensed pose, in joint index order
+  std::vector<float> start_positions_;   // sensed pose at the first tick, in motion joint order
+  std::vector<float> positions_;
+  std::vector<float> stiffnesses_;
+
+  // fixed_point engine: playbacks evaluate a FixedMotion from integer microseconds, in Q format
+  bool fixed_point_;
+  std::vector<std::shared_ptr<const motion::FixedMotion>> fixed_motions_;
+  std::vector<int32_t> fixed_start_positions_;
+  std::vector<int32_t> fixed_positions_;
+  std::vector<int32_t> fixed_stiffnesses_;
+
+  std::mutex mutex_;
+};
+
+}  // namespace nao_pos_fleet_server_ns
+
+#endif  // NAO_POS_SERVER__NAO_POS_FLEET_SERVER_HPP_
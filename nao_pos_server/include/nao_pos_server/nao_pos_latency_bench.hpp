@@ -0,0 +1,86 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NAO_POS_SERVER__NAO_POS_LATENCY_BENCH_HPP_
+#define NAO_POS_SERVER__NAO_POS_LATENCY_BENCH_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rclcpp/rclcpp.hpp"
+#include "rclcpp_action/rclcpp_action.hpp"
+
+#include "nao_lola_command_msgs/msg/joint_positions.hpp"
+#include "nao_lola_sensor_msgs/msg/joint_positions.hpp"
+#include "nao_pos_interfaces/action/pos_play.hpp"
+
+namespace nao_pos_latency_bench_ns
+{
+
+// Stands in for the robot to measure the sensor-to-command latency of a pos action server:
+// publishes /sensors/joint_positions at the LoLA rate, plays a pos file a few times and
+// measures, for every command received on /effectors/joint_positions, the time elapsed since
+// the last sensor sample was published. The goal path is measured too: time from sending a goal
+// to its acceptance, and to the first command of the playback. Run it against each tick_mode (or process layout)
+// of the server to compare them. Busy threads can be started to measure under CPU contention.
+class NaoPosLatencyBench : public rclcpp::Node
+{
+public:
+  explicit NaoPosLatencyBench(const rclcpp::NodeOptions& options = rclcpp::NodeOptions{});
+  virtual ~NaoPosLatencyBench();
+
+private:
+  using PosPlay = nao_pos_interfaces::action::PosPlay;
+  using Clock = std::chrono::steady_clock;
+
+  void publishSensorSample();
+  void onCommand(const nao_lola_command_msgs::msg::JointPositions& command);
+  void sendGoal();
+  void onGoalResponse(const rclcpp_action::ClientGoalHandle<PosPlay>::SharedPtr& goal_handle);
+  void onResult(const rclcpp_action::ClientGoalHandle<PosPlay>::WrappedResult& result);
+  void report();
+  void logDistribution(const char* name, const std::vector<int64_t>& latencies_ns);
+  static int64_t nowNs();
+
+  std::string pos_file_;
+  int goals_left_;
+
+  rclcpp::Publisher<nao_lola_sensor_msgs::msg::JointPositions>::SharedPtr pub_sensor_;
+  rclcpp::Subscription<nao_lola_command_msgs::msg::JointPositions>::SharedPtr sub_command_;
+  rclcpp_action::Client<PosPlay>::SharedPtr client_;
+  rclcpp::TimerBase::SharedPtr sensor_timer_;
+  rclcpp::TimerBase::SharedPtr start_timer_;
+
+  nao_lola_sensor_msgs::msg::JointPositions sensor_sample_;
+  std::atomic<int64_t> last_sample_ns_{0};  // steady clock
+  std::atomic<uint64_t> sample_seq_{0};
+  uint64_t answered_seq_ = 0;
+  std::vector<int64_t> latencies_ns_;
+
+  std::atomic<int64_t> goal_sent_ns_{0};
+  std::atomic<bool> waiting_first_command_{false};
+  std::vector<int64_t> goal_accept_latencies_ns_;
+  std::vector<int64_t> goal_first_command_latencies_ns_;
+
+  std::vector<std::thread> contention_threads_;
+  std::atomic<bool> contention_running_{true};
+};
+
+}  // namespace nao_pos_latency_bench_ns
+
+#endif  // NAO_POS_SERVER__NAO_POS_LATENCY_BENCH_HPP_
@@ -0,0 +1,41 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef NAO_POS_SERVER__NAO_POS_PUBLISHER_HPP_
+#define NAO_POS_SERVER__NAO_POS_PUBLISHER_HPP_
+
+#include "rclcpp/rclcpp.hpp"
+#include "std_msgs/msg/string.hpp"
+
+namespace nao_pos_publisher_ns
+{
+
+// Periodically requests the pos file set in the pos_file parameter on action_req
+class NaoPosPublisher : public rclcpp::Node
+{
+public:
+  explicit NaoPosPublisher(const rclcpp::NodeOptions& options = rclcpp::NodeOptions{});
+  virtual ~NaoPosPublisher();
+
+private:
+  void timer_callback();
+
+  rclcpp::TimerBase::SharedPtr timer_;
+  rclcpp::Publisher<std_msgs::msg::String>::SharedPtr publisher_;
+};
+
+}  // namespace nao_pos_publisher_ns
+
+#endif  // NAO_POS_SERVER__NAO_POS_PUBLISHER_HPP_
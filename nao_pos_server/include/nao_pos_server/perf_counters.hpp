@@ -0,0 +1,67 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef NAO_POS_SERVER__PERF_COUNTERS_HPP_
+#define NAO_POS_SERVER__PERF_COUNTERS_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace stats
+{
+
+// Hardware performance counters of the calling thread, in user space, read with
+// perf_event_open. Wraps a section of code (the tick) between start and stop.
+// Counters the CPU or the kernel do not support (no PMU, virtual machines, perf disabled) are
+// not available and count 0, so on such machines the counters report nothing and cost nothing.
+// Each thread opens its own set of counters the first time it calls start, and keeps it until it
+// exits. Every PerfCounters used from the thread shares that set, so a tick moving between the
+// threads of a multi-threaded executor reads the counters of its current thread without
+// reopening anything.
+class PerfCounters
+{
+public:
+  enum Counter
+  {
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_MISSES,  // last level cache
+    BRANCH_MISSES,
+    NUM_COUNTERS
+  };
+  using Values = std::array<uint64_t, NUM_COUNTERS>;
+
+  // Opens the counters of the calling thread, whose availability is reported below
+  PerfCounters();
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters & operator=(const PerfCounters &) = delete;
+
+  bool available(Counter counter) const {return available_[counter];}
+  bool anyAvailable() const;
+
+  void start();
+  // Counts since start on the same thread, 0 for the counters not available
+  Values stop();
+
+private:
+  std::array<bool, NUM_COUNTERS> available_{};
+  Values start_{};
+  bool started_ = false;
+};
+
+}  // namespace stats
+
+#endif  // NAO_POS_SERVER__PERF_COUNTERS_HPP_
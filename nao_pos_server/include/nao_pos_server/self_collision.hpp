@@ -0,0 +1,56 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef NAO_POS_SERVER__SELF_COLLISION_HPP_
+#define NAO_POS_SERVER__SELF_COLLISION_HPP_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nao_pos_server/motion.hpp"
+
+// Self collision precheck of motions, run when they are loaded or embedded, never while playing.
+// The body is a set of capsules (segments with a radius) placed by forward kinematics: upper
+// arms, forearms (with the hands), torso, thighs and tibias. Arms are checked against the torso
+// and the legs, which is what a hand-edited motion usually gets wrong.
+namespace collision
+{
+
+// Arm capsule first penetrating a torso or leg capsule over [start_ms, end_ms]
+struct Contact
+{
+  const char * arm;
+  const char * body;
+  float start_ms;
+  float end_ms;
+  float depth_mm;  // deepest penetration over the interval
+};
+
+// Checks every keyframe and samples every sample_period_ms between keyframes (see
+// kinematics::samplePoses), merging consecutive colliding samples into one contact per pair
+std::vector<Contact> check(const motion::Motion & motion, float sample_period_ms = 10.0f);
+
+// Removes the contacts between the (arm, body) pairs of known, the contacts a pos file declares
+// intended with '@ contact <arm> <body>' lines, e.g. a hand resting on a thigh in a getup
+void dropKnown(
+  std::vector<Contact> & contacts, const std::vector<std::pair<std::string, std::string>> & known);
+
+// e.g. "LForeArm collides with LThigh from 1200 ms to 1350 ms (12.5 mm deep)"
+std::string describe(const Contact & contact);
+
+}  // namespace collision
+
+#endif  // NAO_POS_SERVER__SELF_COLLISION_HPP_
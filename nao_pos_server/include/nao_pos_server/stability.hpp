@@ -0,0 +1,65 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef NAO_POS_SERVER__STABILITY_HPP_
+#define NAO_POS_SERVER__STABILITY_HPP_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "nao_pos_server/key_frame.hpp"
+#include "nao_pos_server/motion.hpp"
+
+// Static stability analysis of motions, run when they are loaded, embedded or linted.
+// The center of mass (CoM) of each sampled pose is projected on the ground, in the frame of the
+// support foot, and compared to the support polygon declared by the "@ support" lines of the pos
+// file: one sole, or the convex hull of both soles. Segments without a declared support (and
+// segment 0, which starts from the robot pose) are not analyzed.
+namespace stability
+{
+
+struct Segment
+{
+  std::size_t segment;  // index of the keyframe the segment goes to
+  KeyFrame::Support support;
+  unsigned duration_ms;
+  // Smallest distance of the CoM projection to the edges of the support polygon over the
+  // segment, negative if it leaves the polygon
+  float margin_mm;
+  // First and last sample with the CoM outside the polygon, when margin_mm < 0
+  float unstable_from_ms;
+  float unstable_to_ms;
+  // Shortest duration keeping the zero moment point inside the polygon, in the cart-table
+  // model: ZMP = CoM - CoM height / g * CoM acceleration. Joints are interpolated linearly, so
+  // playing a segment in T ms scales the accelerations by 1 / T^2. NEVER if margin_mm < 0.
+  unsigned min_duration_ms;
+
+  static constexpr unsigned NEVER = static_cast<unsigned>(-1);
+
+  bool stable() const {return margin_mm >= 0.0f && duration_ms >= min_duration_ms;}
+};
+
+// Samples each analyzed segment every sample_period_ms (at least at both ends and the middle)
+std::vector<Segment> analyze(const motion::Motion & motion, float sample_period_ms = 10.0f);
+
+// e.g. "segment 3 (left support): CoM outside the support polygon from 1200 ms to 1350 ms
+// (12.5 mm out)" or "segment 2 (double support): 150 ms, ZMP leaves the support polygon
+// under 240 ms"
+std::string describe(const Segment & segment);
+
+}  // namespace stability
+
+#endif  // NAO_POS_SERVER__STABILITY_HPP_
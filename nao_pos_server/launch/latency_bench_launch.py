@@ -0,0 +1,63 @@
+from launch import LaunchDescription
+from launch.actions import DeclareLaunchArgument
+from launch.conditions import IfCondition, UnlessCondition
+from launch.substitutions import LaunchConfiguration
+from launch_ros.actions import ComposableNodeContainer, Node
+from launch_ros.descriptions import ComposableNode
+
+# Runs nao_pos_latency_bench against the action server, either as two processes
+# (composed:=false) or as two components of one container with intra-process
+# communication (composed:=true), to compare the goal and command path latency of the layouts.
+
+def generate_launch_description():
+    composed = LaunchConfiguration('composed')
+    server_parameters = [{'tick_mode': LaunchConfiguration('tick_mode')}]
+    bench_parameters = [{
+        'pos_file': LaunchConfiguration('pos_file'),
+        'goals': LaunchConfiguration('goals'),
+        'contention_threads': LaunchConfiguration('contention_threads'),
+    }]
+
+    return LaunchDescription([
+        DeclareLaunchArgument('composed', default_value='true'),
+        DeclareLaunchArgument('tick_mode', default_value='executor'),
+        DeclareLaunchArgument('pos_file', default_value='move_head'),
+        DeclareLaunchArgument('goals', default_value='5'),
+        DeclareLaunchArgument('contention_threads', default_value='0'),
+        ComposableNodeContainer(
+            condition=IfCondition(composed),
+            name='nao_pos_bench_container',
+            namespace='',
+            package='rclcpp_components',
+            executable='component_container_mt',
+            composable_node_descriptions=[
+                ComposableNode(
+                    package='nao_pos_server',
+                    plugin='nao_pos_action_server_ns::NaoPosActionServer',
+                    parameters=server_parameters,
+                    extra_arguments=[{'use_intra_process_comms': True}],
+                ),
+                ComposableNode(
+                    package='nao_pos_server',
+                    plugin='nao_pos_latency_bench_ns::NaoPosLatencyBench',
+                    parameters=bench_parameters,
+                    extra_arguments=[{'use_intra_process_comms': True}],
+                ),
+            ],
+            output='screen',
+        ),
+        Node(
+            condition=UnlessCondition(composed),
+            package='nao_pos_server',
+            executable='nao_pos_action_server',
+            parameters=server_parameters,
+            output='screen',
+        ),
+        Node(
+            condition=UnlessCondition(composed),
+            package='nao_pos_server',
+            executable='nao_pos_latency_bench',
+            parameters=bench_parameters,
+            output='screen',
+        ),
+    ])
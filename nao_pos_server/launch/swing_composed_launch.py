@@ -0,0 +1,49 @@
+from launch import LaunchDescription
+from launch_ros.actions import ComposableNodeContainer
+from launch_ros.descriptions import ComposableNode
+
+# Same stack as swing_launch.py, loaded in a single process. Goals, requests and commands
+# between the components go through intra-process communication. Like swing_launch.py it only
+# starts the legs group: nodes of other packages (head, arms, perception) are not composed here.
+action_remappings = [
+    ('nao_pos_action/_action/feedback', 'nao_pos_action_legs/_action/feedback'),
+    ('nao_pos_action/_action/status', 'nao_pos_action_legs/_action/status'),
+    ('nao_pos_action/_action/cancel_goal', 'nao_pos_action_legs/_action/cancel_goal'),
+    ('nao_pos_action/_action/get_result', 'nao_pos_action_legs/_action/get_result'),
+    ('nao_pos_action/_action/send_goal', 'nao_pos_action_legs/_action/send_goal'),
+]
+
+def generate_launch_description():
+    intra_process = [{'use_intra_process_comms': True}]
+    return LaunchDescription([
+        ComposableNodeContainer(
+            name='nao_pos_container_legs',
+            namespace='',
+            package='rclcpp_components',
+            executable='component_container_mt',
+            composable_node_descriptions=[
+                ComposableNode(
+                    package='nao_pos_server',
+                    plugin='nao_pos_action_server_ns::NaoPosActionServer',
+                    name='nao_pos_action_server_legs',
+                    remappings=action_remappings,
+                    extra_arguments=intra_process,
+                ),
+                ComposableNode(
+                    package='nao_pos_server',
+                    plugin='nao_pos_action_client_ns::NaoPosActionClient',
+                    name='nao_pos_action_client_legs',
+                    remappings=action_remappings + [('action_req', 'action_req_legs')],
+                    extra_arguments=intra_process,
+                ),
+                ComposableNode(
+                    package='nao_pos_server',
+                    plugin='nao_pos_publisher_ns::NaoPosPublisher',
+                    name='nao_pos_publisher_legs',
+                    remappings=[('action_req', 'action_req_legs')],
+                    extra_arguments=intra_process,
+                ),
+            ],
+            output='screen',
+        ),
+    ])
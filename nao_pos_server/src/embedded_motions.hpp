@@ -0,0 +1,40 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef EMBEDDED_MOTIONS_HPP_
+#define EMBEDDED_MOTIONS_HPP_
+
+#include "nao_pos_server/motion.hpp"
+
+namespace motion
+{
+namespace embedded
+{
+
+struct EmbeddedMotion
+{
+  const char * name;  // pos file name without extension
+  const Motion * motion;
+};
+
+// Motions embedded at build time (EMBEDDED_MOTIONS in CMakeLists.txt). Defined in
+// embedded_motions.cpp, generated in the build directory by nao_pos_embed, as views over
+// constexpr tables. Terminated by {nullptr, nullptr}.
+extern const EmbeddedMotion motions[];
+
+}  // namespace embedded
+}  // namespace motion
+
+#endif  // EMBEDDED_MOTIONS_HPP_
@@ -0,0 +1,140 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nao_pos_server/execution_stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+
+namespace stats
+{
+
+using Result = ExecutionStats::Result;
+
+// Joint group of every joint index
+static const uint8_t jointGroups[nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS] = {
+  Result::GROUP_HEAD,        // HEADYAW
+  Result::GROUP_HEAD,        // HEADPITCH
+  Result::GROUP_LEFT_ARM,    // LSHOULDERPITCH
+  Result::GROUP_LEFT_ARM,    // LSHOULDERROLL
+  Result::GROUP_LEFT_ARM,    // LELBOWYAW
+  Result::GROUP_LEFT_ARM,    // LELBOWROLL
+  Result::GROUP_LEFT_ARM,    // LWRISTYAW
+  Result::GROUP_LEFT_LEG,    // LHIPYAWPITCH
+  Result::GROUP_LEFT_LEG,    // LHIPROLL
+  Result::GROUP_LEFT_LEG,    // LHIPPITCH
+  Result::GROUP_LEFT_LEG,    // LKNEEPITCH
+  Result::GROUP_LEFT_LEG,    // LANKLEPITCH
+  Result::GROUP_LEFT_LEG,    // LANKLEROLL
+  Result::GROUP_RIGHT_LEG,   // RHIPROLL
+  Result::GROUP_RIGHT_LEG,   // RHIPPITCH
+  Result::GROUP_RIGHT_LEG,   // RKNEEPITCH
+  Result::GROUP_RIGHT_LEG,   // RANKLEPITCH
+  Result::GROUP_RIGHT_LEG,   // RANKLEROLL
+  Result::GROUP_RIGHT_ARM,   // RSHOULDERPITCH
+  Result::GROUP_RIGHT_ARM,   // RSHOULDERROLL
+  Result::GROUP_RIGHT_ARM,   // RELBOWYAW
+  Result::GROUP_RIGHT_ARM,   // RELBOWROLL
+  Result::GROUP_RIGHT_ARM,   // RWRISTYAW
+  Result::GROUP_LEFT_ARM,    // LHAND
+  Result::GROUP_RIGHT_ARM};  // RHAND
+
+void ExecutionStats::reset(Clock::duration deadline)
+{
+  *this = ExecutionStats{};
+  deadline_ = deadline;
+}
+
+void ExecutionStats::recordTick(Clock::time_point start, Clock::time_point end)
+{
+  if (ticks_ == 0) {
+    first_tick_ = start;
+  } else if (start - last_tick_ > deadline_) {
+    ++deadline_misses_;
+  }
+  last_tick_ = start;
+  ++ticks_;
+
+  auto latency = end - start;
+  max_latency_ = std::max(max_latency_, latency);
+  auto latency_us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+  std::size_t bucket = std::min<std::size_t>(latency_us / BUCKET_US, NUM_BUCKETS - 1);
+  ++latency_histogram_[bucket];
+}
+
+float ExecutionStats::recordTrackingError(
+  const uint8_t * joints, std::size_t numJoints, const float * commanded, const float * sensed)
+{
+  float tickMaxError = 0.0f;
+  for (std::size_t j = 0; j < numJoints; ++j) {
+    float error = std::abs(sensed[joints[j]] - commanded[j]);
+    uint8_t group = jointGroups[joints[j]];
+    max_error_[group] = std::max(max_error_[group], error);
+    sum_error_[group] += error;
+    ++num_error_samples_[group];
+    tickMaxError = std::max(tickMaxError, error);
+  }
+  return tickMaxError;
+}
+
+void ExecutionStats::recordPerfCounters(const PerfCounters::Values & values)
+{
+  for (std::size_t c = 0; c < PerfCounters::NUM_COUNTERS; ++c) {
+    sum_counters_[c] += values[c];
+  }
+  ++counted_ticks_;
+}
+
+void ExecutionStats::fillResult(Result & result) const
+{
+  result.ticks = ticks_;
+  result.deadline_misses = deadline_misses_;
+
+  double elapsed_s = std::chrono::duration<double>(last_tick_ - first_tick_).count();
+  result.command_rate_hz = ticks_ > 1 ? (ticks_ - 1) / elapsed_s : 0.0;
+
+  result.max_tick_latency_us = std::chrono::duration<float, std::micro>(max_latency_).count();
+
+  // Upper edge of the bucket holding the 99th percentile
+  uint32_t rank = ticks_ - ticks_ / 100;
+  uint32_t count = 0;
+  result.p99_tick_latency_us = 0;
+  for (std::size_t bucket = 0; bucket < NUM_BUCKETS && ticks_ > 0; ++bucket) {
+    count += latency_histogram_[bucket];
+    if (count >= rank) {
+      result.p99_tick_latency_us = std::min<float>(
+        (bucket + 1) * BUCKET_US, result.max_tick_latency_us);
+      break;
+    }
+  }
+
+  for (std::size_t group = 0; group < Result::NUM_GROUPS; ++group) {
+    result.max_tracking_error[group] = max_error_[group];
+    result.mean_tracking_error[group] =
+      num_error_samples_[group] > 0 ? sum_error_[group] / num_error_samples_[group] : 0.0;
+  }
+
+  auto mean = [this](PerfCounters::Counter counter) {
+      return counted_ticks_ > 0 ?
+             static_cast<double>(sum_counters_[counter]) / counted_ticks_ : 0.0;
+    };
+  result.mean_tick_cycles = mean(PerfCounters::CYCLES);
+  result.mean_tick_instructions = mean(PerfCounters::INSTRUCTIONS);
+  result.mean_tick_cache_misses = mean(PerfCounters::CACHE_MISSES);
+  result.mean_tick_branch_misses = mean(PerfCounters::BRANCH_MISSES);
+}
+
+}  // namespace stats
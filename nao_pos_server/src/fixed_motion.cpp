@@ -0,0 +1,112 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "nao_pos_server/fixed_motion.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace motion
+{
+
+int32_t FixedMotion::toFixed(float value)
+{
+  // Scaling by a power of two is exact, lround rounds half away from zero whatever the
+  // current rounding mode
+  const double scaled = std::ldexp(static_cast<double>(value), FRACTION_BITS);
+  const double max = std::numeric_limits<int32_t>::max();
+  const double min = std::numeric_limits<int32_t>::min();
+  return static_cast<int32_t>(std::lround(std::min(std::max(scaled, min), max)));
+}
+
+float FixedMotion::toFloat(int32_t value)
+{
+  return std::ldexp(static_cast<float>(value), -FRACTION_BITS);
+}
+
+std::shared_ptr<const FixedMotion> FixedMotion::fromMotion(const Motion & motion)
+{
+  auto fixed = std::make_shared<FixedMotion>();
+  const std::size_t numKeyFrames = motion.numKeyFrames();
+  const std::size_t numJoints = motion.numJoints();
+
+  fixed->joints_.assign(motion.joints().begin(), motion.joints().end());
+  fixed->times_us_.reserve(numKeyFrames);
+  fixed->positions_.reserve(numKeyFrames * numJoints);
+  fixed->stiffnesses_.reserve(numKeyFrames * numJoints);
+
+  for (std::size_t k = 0; k < numKeyFrames; ++k) {
+    fixed->times_us_.push_back(static_cast<int64_t>(motion.timeMs(k)) * 1000);
+    for (std::size_t j = 0; j < numJoints; ++j) {
+      fixed->positions_.push_back(toFixed(motion.positions(k)[j]));
+      fixed->stiffnesses_.push_back(toFixed(motion.stiffnesses(k)[j]));
+    }
+  }
+
+  return fixed;
+}
+
+std::size_t FixedMotion::segmentAt(int64_t time_us) const
+{
+  auto it = std::upper_bound(times_us_.begin(), times_us_.end(), time_us);
+  return std::min<std::size_t>(it - times_us_.begin(), times_us_.size() - 1);
+}
+
+std::size_t FixedMotion::segmentFrom(std::size_t hint, int64_t time_us) const
+{
+  std::size_t segment = hint;
+  while (segment + 1 < times_us_.size() && time_us >= times_us_[segment]) {
+    ++segment;
+  }
+  return segment;
+}
+
+void FixedMotion::interpolate(
+  std::size_t segment, int64_t time_us, const int32_t * start, int32_t * positions_out,
+  int32_t * stiffnesses_out) const
+{
+  const std::size_t numJoints = joints_.size();
+  const int32_t * previous = segment == 0 ? start : positions(segment - 1);
+  const int32_t * next = positions(segment);
+  const int32_t * nextStiffnesses = stiffnesses(segment);
+
+  const int64_t previousTime = segment == 0 ? 0 : times_us_[segment - 1];
+  const int64_t duration = times_us_[segment] - previousTime;
+  const int64_t elapsed = std::min(std::max<int64_t>(time_us - previousTime, 0), duration);
+
+  if (duration <= 0) {
+    std::copy(next, next + numJoints, positions_out);
+  } else {
+    // |next - previous| < 2^32 and elapsed <= duration, well within int64 for any pos file
+    for (std::size_t j = 0; j < numJoints; ++j) {
+      const int64_t delta = static_cast<int64_t>(next[j]) - previous[j];
+      positions_out[j] = static_cast<int32_t>(previous[j] + delta * elapsed / duration);
+    }
+  }
+  std::copy(nextStiffnesses, nextStiffnesses + numJoints, stiffnesses_out);
+}
+
+void FixedMotion::evaluate(
+  int64_t time_us, const int32_t * start, int32_t * positions_out,
+  int32_t * stiffnesses_out) const
+{
+  interpolate(segmentAt(time_us), time_us, start, positions_out, stiffnesses_out);
+}
+
+}  // namespace motion
@@ -0,0 +1,266 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nao_pos_server/flight_recorder.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace recorder
+{
+
+static constexpr char MAGIC[8] = {'N', 'A', 'O', 'P', 'O', 'S', 'F', 'R'};
+static constexpr uint32_t VERSION = 1;
+
+static_assert(Sample::MAX_GOAL_NAME < 256, "goal name sizes are stored in numJoints");
+static_assert(sizeof(Sample::joints) >= sizeof(int64_t), "goal start times are stored in joints");
+
+std::string Sample::goalName() const
+{
+  std::string name(std::min<std::size_t>(numJoints, MAX_GOAL_NAME), '\0');
+  std::memcpy(&name[0], values, name.size());
+  return name;
+}
+
+int64_t Sample::goalStartNs() const
+{
+  int64_t start_ns;
+  std::memcpy(&start_ns, joints, sizeof(start_ns));
+  return start_ns;
+}
+
+// File layout: the header, then capacity slots. Slot n % capacity holds record n.
+struct alignas(64) FlightRecorder::Header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t slotSize;
+  uint64_t capacity;
+  std::atomic<uint64_t> next;  // number of the next record
+};
+
+struct FlightRecorder::Slot
+{
+  // Number of the record held + 1, 0 while it is being written
+  std::atomic<uint64_t> sequence;
+  int64_t stamp_ns;
+  Kind kind;
+  uint8_t numJoints;
+  uint8_t joints[Sample::MAX_JOINTS];
+  float values[Sample::MAX_JOINTS];
+};
+
+// Shared with other processes through the file
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "recorder needs lock-free atomics");
+
+std::unique_ptr<FlightRecorder> FlightRecorder::create(
+  const std::string & path, std::size_t capacity)
+{
+  if (capacity == 0) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  const std::size_t size = sizeof(Header) + capacity * sizeof(Slot);
+
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat status;
+  bool reuse = ::fstat(fd, &status) == 0 && static_cast<std::size_t>(status.st_size) == size;
+  // Allocate every block now, so recording never has to
+  int error = !reuse && ::ftruncate(fd, size) != 0 ? errno : ::posix_fallocate(fd, 0, size);
+  if (error != 0) {
+    ::close(fd);
+    errno = error;
+    return nullptr;
+  }
+  // Populated, so recording does not page fault either
+  void * mapping =
+    ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+  error = errno;
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    errno = error;
+    return nullptr;
+  }
+
+  const Header * existing = static_cast<const Header *>(mapping);
+  reuse = reuse && std::equal(MAGIC, MAGIC + sizeof(MAGIC), existing->magic) &&
+    existing->version == VERSION && existing->slotSize == sizeof(Slot) &&
+    existing->capacity == capacity;
+  if (!reuse) {
+    std::memset(mapping, 0, size);
+    Header * header = new (mapping) Header{};
+    std::copy(MAGIC, MAGIC + sizeof(MAGIC), header->magic);
+    header->version = VERSION;
+    header->slotSize = sizeof(Slot);
+    header->capacity = capacity;
+  }
+  return std::unique_ptr<FlightRecorder>(new FlightRecorder(mapping, size, capacity));
+}
+
+FlightRecorder::FlightRecorder(void * mapping, std::size_t size, std::size_t capacity)
+: mapping_(mapping),
+  size_(size),
+  capacity_(capacity),
+  header_(static_cast<Header *>(mapping)),
+  slots_(reinterpret_cast<Slot *>(static_cast<char *>(mapping) + sizeof(Header)))
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+  // The file keeps the records
+  ::munmap(mapping_, size_);
+}
+
+FlightRecorder::Slot & FlightRecorder::reserve(uint64_t & n)
+{
+  n = header_->next.fetch_add(1, std::memory_order_relaxed);
+  Slot & slot = slots_[n % capacity_];
+
+  // Readers drop the slot until the new sequence is published
+  slot.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return slot;
+}
+
+void FlightRecorder::commit(Slot & slot, uint64_t n)
+{
+  slot.sequence.store(n + 1, std::memory_order_release);
+}
+
+void FlightRecorder::record(
+  Kind kind, int64_t stamp_ns, const uint8_t * joints, const float * values,
+  std::size_t numJoints)
+{
+  uint64_t n;
+  Slot & slot = reserve(n);
+  numJoints = std::min(numJoints, Sample::MAX_JOINTS);
+  slot.stamp_ns = stamp_ns;
+  slot.kind = kind;
+  slot.numJoints = static_cast<uint8_t>(numJoints);
+  std::copy_n(joints, numJoints, slot.joints);
+  std::copy_n(values, numJoints, slot.values);
+  commit(slot, n);
+}
+
+void FlightRecorder::record(
+  Kind kind, int64_t stamp_ns, const float * values, std::size_t numJoints)
+{
+  static constexpr uint8_t ALL_JOINTS[Sample::MAX_JOINTS] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24};
+  record(kind, stamp_ns, ALL_JOINTS, values, std::min(numJoints, Sample::MAX_JOINTS));
+}
+
+void FlightRecorder::recordGoal(
+  Kind kind, int64_t stamp_ns, const std::string & name, int64_t start_ns)
+{
+  uint64_t n;
+  Slot & slot = reserve(n);
+  const std::size_t size = std::min(name.size(), Sample::MAX_GOAL_NAME);
+  slot.stamp_ns = stamp_ns;
+  slot.kind = kind;
+  slot.numJoints = static_cast<uint8_t>(size);
+  std::memcpy(slot.joints, &start_ns, sizeof(start_ns));
+  std::memcpy(slot.values, name.data(), size);
+  commit(slot, n);
+}
+
+uint64_t FlightRecorder::numRecorded() const
+{
+  return header_->next.load(std::memory_order_relaxed);
+}
+
+std::vector<Sample> FlightRecorder::snapshot() const
+{
+  return read(*header_, slots_);
+}
+
+std::vector<Sample> FlightRecorder::read(const Header & header, const Slot * slots)
+{
+  const uint64_t capacity = header.capacity;
+  const uint64_t next = header.next.load(std::memory_order_acquire);
+  const uint64_t first = next > capacity ? next - capacity : 0;
+
+  std::vector<Sample> samples;
+  samples.reserve(next - first);
+  for (uint64_t n = first; n < next; ++n) {
+    const Slot & slot = slots[n % capacity];
+    if (slot.sequence.load(std::memory_order_acquire) != n + 1) {
+      // Being written, or never completed by a writer that crashed
+      continue;
+    }
+    Sample sample;
+    sample.stamp_ns = slot.stamp_ns;
+    sample.kind = slot.kind;
+    sample.numJoints = slot.numJoints;
+    // Goal records use every byte, copied as is
+    std::memcpy(sample.joints, slot.joints, sizeof(sample.joints));
+    std::memcpy(sample.values, slot.values, sizeof(sample.values));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != n + 1) {
+      // Overwritten while copying it
+      continue;
+    }
+    samples.push_back(sample);
+  }
+  return samples;
+}
+
+std::optional<std::vector<Sample>> FlightRecorder::readFile(const std::string & path)
+{
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  struct stat status;
+  if (::fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(Header)) {
+    ::close(fd);
+    return std::nullopt;
+  }
+  const std::size_t size = status.st_size;
+  void * mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return std::nullopt;
+  }
+
+  const Header * header = static_cast<const Header *>(mapping);
+  std::optional<std::vector<Sample>> samples;
+  if (std::equal(MAGIC, MAGIC + sizeof(MAGIC), header->magic) && header->version == VERSION &&
+    header->slotSize == sizeof(Slot) && header->capacity > 0 &&
+    size == sizeof(Header) + header->capacity * sizeof(Slot))
+  {
+    samples = read(
+      *header, reinterpret_cast<const Slot *>(static_cast<const char *>(mapping) + sizeof(Header)));
+  }
+  ::munmap(mapping, size);
+  return samples;
+}
+
+}  // namespace recorder
@@ -15,6 +15,7 @@
 #ifndef INDEXES_HPP_
 #define INDEXES_HPP_
 
+#include <string>
 #include <vector>
 
 #include "nao_lola_command_msgs/msg/joint_indexes.hpp"
@@ -49,6 +50,11 @@ static const std::vector<uint8_t> indexes = {
   nao_lola_command_msgs::msg::JointIndexes::LHAND,
   nao_lola_command_msgs::msg::JointIndexes::RHAND};
 
+// Short joint names, in the same order, as used in pos/joint names.txt
+static const std::vector<std::string> names = {
+  "HY", "HP", "LSP", "LSR", "LEY", "LER", "LWY", "LHYP", "LHR", "LHP", "LKP", "LAP", "LAR",
+  "RHR", "RHP", "RKP", "RAP", "RAR", "RSP", "RSR", "REY", "RER", "RWY", "LH", "RH"};
+
 }  // namespace indexes
 
 #endif  // INDEXES_HPP_
@@ -0,0 +1,60 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef JOINT_LIMITS_HPP_
+#define JOINT_LIMITS_HPP_
+
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+
+namespace joint_limits
+{
+
+struct Range
+{
+  float min;
+  float max;
+};
+
+// NAO v6 joint ranges, in pos file units (degrees, hands are 0 closed to 1 open),
+// indexed by joint index
+static const Range degrees[nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS] = {
+  {-119.5f, 119.5f},   // HEADYAW
+  {-38.5f, 29.5f},     // HEADPITCH
+  {-119.5f, 119.5f},   // LSHOULDERPITCH
+  {-18.0f, 76.0f},     // LSHOULDERROLL
+  {-119.5f, 119.5f},   // LELBOWYAW
+  {-88.5f, -2.0f},     // LELBOWROLL
+  {-104.5f, 104.5f},   // LWRISTYAW
+  {-65.62f, 42.44f},   // LHIPYAWPITCH
+  {-21.74f, 45.29f},   // LHIPROLL
+  {-88.0f, 27.73f},    // LHIPPITCH
+  {-5.29f, 121.04f},   // LKNEEPITCH
+  {-68.15f, 52.86f},   // LANKLEPITCH
+  {-22.79f, 44.06f},   // LANKLEROLL
+  {-45.29f, 21.74f},   // RHIPROLL
+  {-88.0f, 27.73f},    // RHIPPITCH
+  {-5.9f, 121.47f},    // RKNEEPITCH
+  {-67.97f, 53.4f},    // RANKLEPITCH
+  {-44.06f, 22.8f},    // RANKLEROLL
+  {-119.5f, 119.5f},   // RSHOULDERPITCH
+  {-76.0f, 18.0f},     // RSHOULDERROLL
+  {-119.5f, 119.5f},   // RELBOWYAW
+  {2.0f, 88.5f},       // RELBOWROLL
+  {-104.5f, 104.5f},   // RWRISTYAW
+  {0.0f, 1.0f},        // LHAND
+  {0.0f, 1.0f}};       // RHAND
+
+}  // namespace joint_limits
+
+#endif  // JOINT_LIMITS_HPP_
@@ -0,0 +1,218 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "nao_pos_server/key_frame_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+
+namespace motion
+{
+
+static constexpr std::size_t NO_TREE = static_cast<std::size_t>(-1);
+
+KeyFrameIndex::KeyFrameIndex(
+  const std::vector<std::pair<std::string, std::shared_ptr<const Motion>>> & motions)
+: entries_(motions)
+{
+  // Unordered rows of each group, reordered once the tree is built
+  std::vector<std::vector<float>> groupPoints;
+  std::vector<std::vector<uint32_t>> groupEntries;
+  std::vector<std::vector<uint32_t>> groupKeyFrames;
+
+  treeOf_.assign(entries_.size(), NO_TREE);
+  for (std::size_t e = 0; e < entries_.size(); ++e) {
+    const Motion & motion = *entries_[e].second;
+    if (motion.numKeyFrames() == 0 || motion.numJoints() == 0) {
+      continue;
+    }
+    auto joints = motion.joints();
+    std::size_t t = 0;
+    while (t < trees_.size() &&
+      !std::equal(joints.begin(), joints.end(), trees_[t].joints.begin(), trees_[t].joints.end()))
+    {
+      ++t;
+    }
+    if (t == trees_.size()) {
+      trees_.emplace_back();
+      trees_.back().joints.assign(joints.begin(), joints.end());
+      groupPoints.emplace_back();
+      groupEntries.emplace_back();
+      groupKeyFrames.emplace_back();
+    }
+    treeOf_[e] = t;
+    for (std::size_t k = 0; k < motion.numKeyFrames(); ++k) {
+      groupPoints[t].insert(
+        groupPoints[t].end(), motion.positions(k), motion.positions(k) + motion.numJoints());
+      groupEntries[t].push_back(e);
+      groupKeyFrames[t].push_back(k);
+    }
+  }
+
+  for (std::size_t t = 0; t < trees_.size(); ++t) {
+    Tree & tree = trees_[t];
+    const std::size_t size = groupKeyFrames[t].size();
+    const std::size_t dimension = tree.dimension();
+    std::vector<uint32_t> order(size);
+    std::iota(order.begin(), order.end(), 0);
+    tree.axes.assign(size, 0);
+    build(tree, groupPoints[t], order, 0, size);
+
+    tree.points.resize(size * dimension);
+    tree.entries.resize(size);
+    tree.keyFrames.resize(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      std::copy_n(&groupPoints[t][order[i] * dimension], dimension, &tree.points[i * dimension]);
+      tree.entries[i] = groupEntries[t][order[i]];
+      tree.keyFrames[i] = groupKeyFrames[t][order[i]];
+    }
+  }
+}
+
+void KeyFrameIndex::build(
+  Tree & tree, const std::vector<float> & points, std::vector<uint32_t> & order,
+  std::size_t begin, std::size_t end)
+{
+  if (end - begin <= 1) {
+    return;
+  }
+
+  // Split along the joint with the widest spread
+  const std::size_t dimension = tree.dimension();
+  std::size_t axis = 0;
+  float widest = -1.0f;
+  for (std::size_t a = 0; a < dimension; ++a) {
+    auto [min, max] = std::minmax_element(
+      order.begin() + begin, order.begin() + end, [&](uint32_t l, uint32_t r) {
+        return points[l * dimension + a] < points[r * dimension + a];
+      });
+    const float spread = points[*max * dimension + a] - points[*min * dimension + a];
+    if (spread > widest) {
+      widest = spread;
+      axis = a;
+    }
+  }
+
+  const std::size_t middle = begin + (end - begin) / 2;
+  std::nth_element(
+    order.begin() + begin, order.begin() + middle, order.begin() + end,
+    [&](uint32_t l, uint32_t r) {
+      return points[l * dimension + axis] < points[r * dimension + axis];
+    });
+  tree.axes[middle] = axis;
+  build(tree, points, order, begin, middle);
+  build(tree, points, order, middle + 1, end);
+}
+
+void KeyFrameIndex::search(
+  const Tree & tree, std::size_t begin, std::size_t end, Search & search)
+{
+  if (begin >= end) {
+    return;
+  }
+
+  const std::size_t dimension = tree.dimension();
+  const std::size_t middle = begin + (end - begin) / 2;
+  const float * point = &tree.points[middle * dimension];
+
+  if (search.entry == ANY_ENTRY || tree.entries[middle] == search.entry) {
+    float distance2 = 0.0f;
+    for (std::size_t j = 0; j < dimension; ++j) {
+      const float d = search.query[j] - point[j];
+      distance2 += d * d;
+    }
+    if (distance2 < search.bestDistance2) {
+      search.bestDistance2 = distance2;
+      search.best = middle;
+    }
+  }
+
+  // Leaves have no split, their axis is unused
+  const std::size_t axis = tree.axes[middle];
+  const float offset = search.query[axis] - point[axis];
+  const bool lowFirst = offset < 0.0f;
+  KeyFrameIndex::search(
+    tree, lowFirst ? begin : middle + 1, lowFirst ? middle : end, search);
+  // The other side can only hold a closer point if the splitting plane is closer than the best
+  if (offset * offset < search.bestDistance2) {
+    KeyFrameIndex::search(
+      tree, lowFirst ? middle + 1 : begin, lowFirst ? end : middle, search);
+  }
+}
+
+std::optional<KeyFrameIndex::Match> KeyFrameIndex::nearestIn(
+  std::size_t t, std::size_t entry, const float * pose) const
+{
+  const Tree & tree = trees_[t];
+  const std::size_t dimension = tree.dimension();
+
+  float query[nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS];
+  for (std::size_t j = 0; j < dimension; ++j) {
+    query[j] = pose[tree.joints[j]];
+  }
+
+  Search s{query, entry, std::numeric_limits<float>::infinity(), tree.size()};
+  search(tree, 0, tree.size(), s);
+  if (s.best == tree.size()) {
+    return std::nullopt;
+  }
+  const auto & matched = entries_[tree.entries[s.best]];
+  return Match{
+    &matched.first, matched.second.get(), tree.keyFrames[s.best],
+    std::sqrt(s.bestDistance2 / dimension)};
+}
+
+std::optional<KeyFrameIndex::Match> KeyFrameIndex::nearest(
+  const Motion & motion, const float * pose) const
+{
+  for (std::size_t e = 0; e < entries_.size(); ++e) {
+    if (entries_[e].second.get() == &motion && treeOf_[e] != NO_TREE) {
+      return nearestIn(treeOf_[e], e, pose);
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<KeyFrameIndex::Match> KeyFrameIndex::nearest(const float * pose) const
+{
+  std::optional<Match> best;
+  for (std::size_t t = 0; t < trees_.size(); ++t) {
+    auto match = nearestIn(t, ANY_ENTRY, pose);
+    if (match && (!best || match->distance < best->distance)) {
+      best = match;
+    }
+  }
+  return best;
+}
+
+std::size_t KeyFrameIndex::numKeyFrames() const
+{
+  std::size_t count = 0;
+  for (const auto & tree : trees_) {
+    count += tree.size();
+  }
+  return count;
+}
+
+}  // namespace motion
@@ -0,0 +1,113 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "nao_pos_server/key_frame_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace motion
+{
+
+KeyFramePool::KeyFramePool(std::pmr::memory_resource * upstream)
+: memory_(upstream)
+{
+}
+
+int64_t KeyFramePool::quantize(float value)
+{
+  return std::llround(static_cast<double>(value) / QUANTUM);
+}
+
+std::size_t KeyFramePool::hash(const float * row, std::size_t size)
+{
+  std::size_t hash = size;
+  for (std::size_t i = 0; i < size; ++i) {
+    // boost::hash_combine
+    hash ^= std::hash<int64_t>{}(quantize(row[i])) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+  }
+  return hash;
+}
+
+const float * KeyFramePool::intern(const float * row, std::size_t size)
+{
+  const std::size_t rowHash = hash(row, size);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++numInterned_;
+
+  auto range = rows_.equal_range(rowHash);
+  for (auto it = range.first; it != range.second; ++it) {
+    Row & stored = it->second;
+    if (stored.size == size &&
+      std::equal(
+        row, row + size, stored.values, [](float a, float b) {
+          return quantize(a) == quantize(b);
+        }))
+    {
+      ++stored.references;
+      return stored.values;
+    }
+  }
+
+  auto * values = static_cast<float *>(memory_.allocate(size * sizeof(float), alignof(float)));
+  std::copy(row, row + size, values);
+  rows_.emplace(rowHash, Row{values, size, 1});
+  storedValues_ += size;
+  return values;
+}
+
+void KeyFramePool::release(const float * row, std::size_t size)
+{
+  // The stored values hash as the row first interned, which they are a copy of
+  const std::size_t rowHash = hash(row, size);
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto range = rows_.equal_range(rowHash);
+  for (auto it = range.first; it != range.second; ++it) {
+    Row & stored = it->second;
+    if (stored.values == row) {
+      if (--stored.references == 0) {
+        memory_.deallocate(stored.values, size * sizeof(float), alignof(float));
+        storedValues_ -= size;
+        rows_.erase(it);
+      }
+      return;
+    }
+  }
+}
+
+std::size_t KeyFramePool::numRows() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return rows_.size();
+}
+
+std::size_t KeyFramePool::numInterned() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return numInterned_;
+}
+
+std::size_t KeyFramePool::storedValues() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return storedValues_;
+}
+
+}  // namespace motion
@@ -0,0 +1,218 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "nao_pos_server/kinematics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+
+namespace kinematics
+{
+
+using nao_lola_command_msgs::msg::JointIndexes;
+
+static Frame multiply(const Frame & a, const Frame & b)
+{
+  Frame result;
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 3; ++col) {
+      result.rotation[row * 3 + col] =
+        a.rotation[row * 3] * b.rotation[col] +
+        a.rotation[row * 3 + 1] * b.rotation[3 + col] +
+        a.rotation[row * 3 + 2] * b.rotation[6 + col];
+    }
+  }
+  result.position = a.transform(b.position);
+  return result;
+}
+
+// Rotation of angle around the unit axis, after a translation of offset (Rodrigues formula)
+static Frame joint(const Vec3 & offset, const Vec3 & axis, float angle)
+{
+  const float c = std::cos(angle);
+  const float s = std::sin(angle);
+  const float t = 1.0f - c;
+  return Frame{
+    {
+      t * axis.x * axis.x + c, t * axis.x * axis.y - s * axis.z, t * axis.x * axis.z + s * axis.y,
+      t * axis.x * axis.y + s * axis.z, t * axis.y * axis.y + c, t * axis.y * axis.z - s * axis.x,
+      t * axis.x * axis.z - s * axis.y, t * axis.y * axis.z + s * axis.x, t * axis.z * axis.z + c},
+    offset};
+}
+
+static constexpr Vec3 ORIGIN{0.0f, 0.0f, 0.0f};
+static constexpr Vec3 X_AXIS{1.0f, 0.0f, 0.0f};
+static constexpr Vec3 Y_AXIS{0.0f, 1.0f, 0.0f};
+static constexpr Vec3 Z_AXIS{0.0f, 0.0f, 1.0f};
+// The hip yaw pitch axis lies in the y-z plane, at 45 degrees
+static constexpr float SQRT1_2 = 0.70710678f;
+static constexpr Vec3 L_HIP_YAW_PITCH_AXIS{0.0f, SQRT1_2, -SQRT1_2};
+static constexpr Vec3 R_HIP_YAW_PITCH_AXIS{0.0f, SQRT1_2, SQRT1_2};
+
+static void arm(
+  const float * pose, const Vec3 & shoulderOffset, const Vec3 & elbowOffset,
+  uint8_t shoulderPitch, uint8_t shoulderRoll, uint8_t elbowYaw, uint8_t elbowRoll,
+  Frame & upperArm, Frame & foreArm)
+{
+  upperArm = multiply(
+    joint(shoulderOffset, Y_AXIS, pose[shoulderPitch]),
+    joint(ORIGIN, Z_AXIS, pose[shoulderRoll]));
+  foreArm = multiply(
+    multiply(upperArm, joint(elbowOffset, X_AXIS, pose[elbowYaw])),
+    joint(ORIGIN, Z_AXIS, pose[elbowRoll]));
+}
+
+static void leg(
+  const float * pose, const Vec3 & hipOffset, const Vec3 & hipYawPitchAxis, uint8_t hipRoll,
+  uint8_t hipPitch, uint8_t kneePitch, uint8_t anklePitch, uint8_t ankleRoll, Frame & thigh,
+  Frame & tibia, Frame & foot)
+{
+  thigh = multiply(
+    multiply(
+      joint(hipOffset, hipYawPitchAxis, pose[JointIndexes::LHIPYAWPITCH]),
+      joint(ORIGIN, X_AXIS, pose[hipRoll])),
+    joint(ORIGIN, Y_AXIS, pose[hipPitch]));
+  tibia = multiply(thigh, joint({0.0f, 0.0f, -THIGH_LENGTH}, Y_AXIS, pose[kneePitch]));
+  foot = multiply(
+    multiply(tibia, joint({0.0f, 0.0f, -TIBIA_LENGTH}, Y_AXIS, pose[anklePitch])),
+    joint(ORIGIN, X_AXIS, pose[ankleRoll]));
+}
+
+void forwardKinematics(const float * poses, std::size_t numPoses, Body * bodies_out)
+{
+  for (std::size_t p = 0; p < numPoses; ++p) {
+    const float * pose = &poses[p * NUM_JOINTS];
+    Body & body = bodies_out[p];
+    arm(
+      pose, L_SHOULDER_OFFSET, L_ELBOW_OFFSET, JointIndexes::LSHOULDERPITCH,
+      JointIndexes::LSHOULDERROLL, JointIndexes::LELBOWYAW, JointIndexes::LELBOWROLL,
+      body.lUpperArm, body.lForeArm);
+    arm(
+      pose, R_SHOULDER_OFFSET, R_ELBOW_OFFSET, JointIndexes::RSHOULDERPITCH,
+      JointIndexes::RSHOULDERROLL, JointIndexes::RELBOWYAW, JointIndexes::RELBOWROLL,
+      body.rUpperArm, body.rForeArm);
+    leg(
+      pose, L_HIP_OFFSET, L_HIP_YAW_PITCH_AXIS, JointIndexes::LHIPROLL, JointIndexes::LHIPPITCH,
+      JointIndexes::LKNEEPITCH, JointIndexes::LANKLEPITCH, JointIndexes::LANKLEROLL,
+      body.lThigh, body.lTibia, body.lFoot);
+    leg(
+      pose, R_HIP_OFFSET, R_HIP_YAW_PITCH_AXIS, JointIndexes::RHIPROLL, JointIndexes::RHIPPITCH,
+      JointIndexes::RKNEEPITCH, JointIndexes::RANKLEPITCH, JointIndexes::RANKLEROLL,
+      body.rThigh, body.rTibia, body.rFoot);
+  }
+}
+
+// Lumped masses (kg) and centers of mass (mm, in the link frame) of the NAO v6 links, from the
+// NAO v6 documentation: trunk is torso, neck and head; upper arm is shoulder and bicep; forearm
+// is elbow, forearm and hand; thigh is pelvis, hip and thigh; foot is ankle and foot.
+struct Mass
+{
+  float kg;
+  Vec3 com;
+};
+
+static constexpr Mass TRUNK{1.733f, {-2.9f, 0.0f, 93.3f}};
+static constexpr Mass L_UPPER_ARM{0.251f, {15.4f, 3.5f, 2.1f}};
+static constexpr Mass R_UPPER_ARM{0.251f, {15.4f, -3.5f, 2.1f}};
+static constexpr Mass FOREARM{0.328f, {57.0f, 0.0f, 2.0f}};
+static constexpr Mass THIGH{0.600f, {-3.6f, 0.0f, -33.0f}};
+static constexpr Mass TIBIA{0.301f, {4.5f, 0.0f, -49.4f}};
+static constexpr Mass FOOT{0.306f, {14.5f, 0.0f, -15.2f}};
+
+Vec3 centerOfMass(const Body & body)
+{
+  Vec3 sum{TRUNK.kg * TRUNK.com.x, TRUNK.kg * TRUNK.com.y, TRUNK.kg * TRUNK.com.z};
+  float total = TRUNK.kg;
+  auto add = [&sum, &total](const Frame & frame, const Mass & mass) {
+      const Vec3 com = frame.transform(mass.com);
+      sum.x += mass.kg * com.x;
+      sum.y += mass.kg * com.y;
+      sum.z += mass.kg * com.z;
+      total += mass.kg;
+    };
+  add(body.lUpperArm, L_UPPER_ARM);
+  add(body.lForeArm, FOREARM);
+  add(body.rUpperArm, R_UPPER_ARM);
+  add(body.rForeArm, FOREARM);
+  add(body.lThigh, THIGH);
+  add(body.lTibia, TIBIA);
+  add(body.lFoot, FOOT);
+  add(body.rThigh, THIGH);
+  add(body.rTibia, TIBIA);
+  add(body.rFoot, FOOT);
+  return {sum.x / total, sum.y / total, sum.z / total};
+}
+
+const float * neutralPose()
+{
+  static const std::vector<float> pose = [] {
+      std::vector<float> values(NUM_JOINTS, 0.0f);
+      values[JointIndexes::LSHOULDERPITCH] = M_PI / 2;
+      values[JointIndexes::LSHOULDERROLL] = 0.1f;
+      values[JointIndexes::LELBOWROLL] = -0.05f;
+      values[JointIndexes::RSHOULDERPITCH] = M_PI / 2;
+      values[JointIndexes::RSHOULDERROLL] = -0.1f;
+      values[JointIndexes::RELBOWROLL] = 0.05f;
+      return values;
+    }();
+  return pose.data();
+}
+
+void samplePoses(
+  const motion::Motion & motion, float period_ms, std::vector<float> & times_ms_out,
+  std::vector<float> & poses_out)
+{
+  times_ms_out.clear();
+  poses_out.clear();
+  const std::size_t numKeyFrames = motion.numKeyFrames();
+  if (numKeyFrames == 0) {
+    return;
+  }
+
+  times_ms_out.push_back(motion.timeMs(0));
+  for (std::size_t k = 1; k < numKeyFrames; ++k) {
+    const float previous = motion.timeMs(k - 1);
+    const float next = motion.timeMs(k);
+    for (float t = previous + period_ms; t < next; t += period_ms) {
+      times_ms_out.push_back(t);
+    }
+    if (next > previous) {
+      times_ms_out.push_back(next);
+    }
+  }
+
+  // Nothing is sampled in segment 0, the start pose is never read
+  const std::size_t numJoints = motion.numJoints();
+  const std::size_t numSamples = times_ms_out.size();
+  std::vector<float> positions(numSamples * numJoints);
+  std::vector<float> stiffnesses(numSamples * numJoints);
+  motion.evaluateBatch(
+    times_ms_out.data(), numSamples, motion.positions(0), positions.data(), stiffnesses.data());
+
+  poses_out.resize(numSamples * NUM_JOINTS);
+  const auto joints = motion.joints();
+  for (std::size_t s = 0; s < numSamples; ++s) {
+    float * pose = &poses_out[s * NUM_JOINTS];
+    std::copy(neutralPose(), neutralPose() + NUM_JOINTS, pose);
+    for (std::size_t j = 0; j < numJoints; ++j) {
+      pose[joints[j]] = positions[s * numJoints + j];
+    }
+  }
+}
+
+}  // namespace kinematics
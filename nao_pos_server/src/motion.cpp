@@ -0,0 +1,197 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nao_pos_server/motion.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+namespace motion
+{
+
+Motion::Motion(const Tables & tables)
+: tables_(tables)
+{
+}
+
+Motion::Motion(std::pmr::memory_resource * upstream, std::size_t arenaSize)
+: tables_{},
+  arena_(std::make_unique<std::pmr::monotonic_buffer_resource>(arenaSize, upstream)),
+  joints_(arena_.get()),
+  times_ms_(arena_.get()),
+  positions_(arena_.get()),
+  stiffnesses_(arena_.get()),
+  position_rows_(arena_.get()),
+  stiffness_rows_(arena_.get()),
+  holds_(arena_.get()),
+  supports_(arena_.get())
+{
+}
+
+Motion::~Motion()
+{
+  if (!pool_) {
+    return;
+  }
+  for (std::size_t k = 0; k < position_rows_.size(); ++k) {
+    pool_->release(position_rows_[k], joints_.size());
+  }
+  for (std::size_t k = 0; k < stiffness_rows_.size(); ++k) {
+    pool_->release(stiffness_rows_[k], joints_.size());
+  }
+}
+
+std::shared_ptr<const Motion> Motion::fromKeyFrames(
+  const std::vector<KeyFrame> & keyFrames, std::pmr::memory_resource * upstream,
+  std::shared_ptr<KeyFramePool> pool)
+{
+  const std::size_t numKeyFrames = keyFrames.size();
+  const std::size_t numJoints =
+    keyFrames.empty() ? 0 : keyFrames.front().positions.indexes.size();
+
+  // Every vector is reserved once to its final size, so the first block of the arena holds
+  // them all. Each allocation may need up to max_align_t padding.
+  const std::size_t rowsSize = pool ? 0 : 2 * numKeyFrames * numJoints * sizeof(float);
+  const std::size_t arenaSize =
+    numJoints * sizeof(uint8_t) + numKeyFrames * sizeof(unsigned) + rowsSize +
+    2 * numKeyFrames * sizeof(const float *) + numKeyFrames * sizeof(uint8_t) +
+    numKeyFrames * sizeof(KeyFrame::Support) + 8 * alignof(std::max_align_t);
+
+  std::shared_ptr<Motion> motion(new Motion(upstream, arenaSize));
+  if (keyFrames.empty()) {
+    return motion;
+  }
+
+  // The parser guarantees that every keyframe actuates the same joints, in the same order,
+  // and that stiffness indexes match position indexes
+  motion->joints_.assign(
+    keyFrames.front().positions.indexes.begin(), keyFrames.front().positions.indexes.end());
+
+  motion->times_ms_.reserve(numKeyFrames);
+  motion->position_rows_.reserve(numKeyFrames);
+  motion->stiffness_rows_.reserve(numKeyFrames);
+  motion->supports_.reserve(numKeyFrames);
+  if (!pool) {
+    motion->positions_.reserve(numKeyFrames * numJoints);
+    motion->stiffnesses_.reserve(numKeyFrames * numJoints);
+  }
+
+  for (const auto & keyFrame : keyFrames) {
+    motion->times_ms_.push_back(keyFrame.t_ms);
+    motion->supports_.push_back(keyFrame.support);
+    const float * positions = keyFrame.positions.positions.data();
+    const float * stiffnesses = keyFrame.stiffnesses.stiffnesses.data();
+    if (pool) {
+      motion->position_rows_.push_back(pool->intern(positions, numJoints));
+      motion->stiffness_rows_.push_back(pool->intern(stiffnesses, numJoints));
+    } else {
+      // Reserved, the rows never move
+      motion->position_rows_.push_back(motion->positions_.data() + motion->positions_.size());
+      motion->stiffness_rows_.push_back(
+        motion->stiffnesses_.data() + motion->stiffnesses_.size());
+      motion->positions_.insert(motion->positions_.end(), positions, positions + numJoints);
+      motion->stiffnesses_.insert(
+        motion->stiffnesses_.end(), stiffnesses, stiffnesses + numJoints);
+    }
+  }
+  motion->pool_ = std::move(pool);
+
+  motion->holds_.assign(numKeyFrames, 0);
+  for (std::size_t k = 1; k < numKeyFrames; ++k) {
+    const float * previous = motion->position_rows_[k - 1];
+    motion->holds_[k] = std::equal(previous, previous + numJoints, motion->position_rows_[k]);
+  }
+
+  motion->tables_ = Tables{
+    motion->joints_.data(), numJoints, motion->times_ms_.data(), numKeyFrames,
+    motion->position_rows_.data(), motion->stiffness_rows_.data(), motion->holds_.data(),
+    motion->supports_.data()};
+
+  return motion;
+}
+
+std::size_t Motion::segmentAt(float time_ms) const
+{
+  const unsigned * times_ms = tables_.times_ms;
+  auto it = std::upper_bound(
+    times_ms, times_ms + numKeyFrames(), time_ms,
+    [](float t, unsigned keyFrameTime) {return t < keyFrameTime;});
+  return std::min<std::size_t>(it - times_ms, numKeyFrames() - 1);
+}
+
+std::size_t Motion::segmentFrom(std::size_t hint, float time_ms) const
+{
+  std::size_t segment = hint;
+  while (segment + 1 < numKeyFrames() && time_ms >= tables_.times_ms[segment]) {
+    ++segment;
+  }
+  return segment;
+}
+
+float Motion::beta(std::size_t segment, float time_ms) const
+{
+  float previousTime = segment == 0 ? 0.0f : tables_.times_ms[segment - 1];
+  float duration = tables_.times_ms[segment] - previousTime;
+  if (duration <= 0.0f) {
+    return 1.0f;
+  }
+  return std::min(std::max((time_ms - previousTime) / duration, 0.0f), 1.0f);
+}
+
+void Motion::interpolate(
+  std::size_t segment, float beta, const float * start, float * positions_out,
+  float * stiffnesses_out) const
+{
+  const std::size_t numJoints = tables_.numJoints;
+  const float * previous = segment == 0 ? start : positions(segment - 1);
+  const float * next = positions(segment);
+  const float * nextStiffnesses = stiffnesses(segment);
+  const float alpha = 1.0f - beta;  // normalized coefficent k of convex combination
+
+  for (std::size_t j = 0; j < numJoints; ++j) {
+    positions_out[j] = previous[j] * alpha + next[j] * beta;
+  }
+  std::copy(nextStiffnesses, nextStiffnesses + numJoints, stiffnesses_out);
+}
+
+void Motion::evaluate(
+  float time_ms, const float * start, float * positions_out, float * stiffnesses_out) const
+{
+  std::size_t segment = segmentAt(time_ms);
+  interpolate(segment, beta(segment, time_ms), start, positions_out, stiffnesses_out);
+}
+
+void Motion::evaluateBatch(
+  const float * times_ms, std::size_t numTimes, const float * start, float * positions_out,
+  float * stiffnesses_out) const
+{
+  const std::size_t numJoints = tables_.numJoints;
+  std::size_t segment = 0;
+  float previousTime = 0.0f;
+
+  for (std::size_t i = 0; i < numTimes; ++i) {
+    const float time_ms = times_ms[i];
+    segment = time_ms >= previousTime ? segmentFrom(segment, time_ms) : segmentAt(time_ms);
+    previousTime = time_ms;
+    interpolate(
+      segment, beta(segment, time_ms), start, positions_out + i * numJoints,
+      stiffnesses_out + i * numJoints);
+  }
+}
+
+}  // namespace motion
@@ -0,0 +1,212 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nao_pos_server/motion_store.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ament_index_cpp/get_package_share_directory.hpp"
+#include "boost/filesystem.hpp"
+#include "embedded_motions.hpp"
+#include "nao_pos_server/self_collision.hpp"
+#include "nao_pos_server/stability.hpp"
+#include "parser.hpp"
+#include "rclcpp/logging.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace motion
+{
+
+static rclcpp::Logger logger = rclcpp::get_logger("motion_store");
+
+MotionStore::MotionStore(
+  const std::string & pos_directory, std::pmr::memory_resource * upstream)
+: pos_directory_(pos_directory),
+  upstream_(upstream),
+  pool_(std::make_shared<KeyFramePool>(upstream))
+{
+  // Embedded motions shadow the files with the same name, make it visible once
+  std::string shadowed;
+  for (const auto * entry = embedded::motions; entry->name; ++entry) {
+    if (fs::exists(getFullFilePath(std::string(entry->name) + ".pos"))) {
+      shadowed += (shadowed.empty() ? "" : ", ") + std::string(entry->name);
+    }
+  }
+  if (!shadowed.empty()) {
+    RCLCPP_INFO(
+      logger, "Serving %s from the motions embedded at build time, edits of their pos files in %s "
+      "are ignored until the next build", shadowed.c_str(), pos_directory_.c_str());
+  }
+}
+
+std::string MotionStore::defaultPosDirectory()
+{
+  std::string package_share_directory =
+    ament_index_cpp::get_package_share_directory("nao_pos_server");
+  return (fs::path(package_share_directory) / fs::path("pos")).string();
+}
+
+std::shared_ptr<const Motion> MotionStore::findEmbedded(const std::string & name)
+{
+  for (const auto * entry = embedded::motions; entry->name; ++entry) {
+    if (name == entry->name) {
+      // Static storage: the aliasing constructor shares nothing and allocates nothing
+      return std::shared_ptr<const Motion>(std::shared_ptr<const Motion>(), entry->motion);
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<const Motion> MotionStore::load(const std::string & name)
+{
+  if (auto motion = findEmbedded(name)) {
+    return motion;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::string filePath = getFullFilePath(name + ".pos");
+  // Version of the file, matches no loaded motion if it is missing
+  struct stat status {};
+  if (::stat(filePath.c_str(), &status) != 0) {
+    status.st_size = -1;
+  }
+  const int64_t mtime_ns = status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+
+  auto it = motions_.find(name);
+  if (it != motions_.end()) {
+    if (it->second.mtime_ns == mtime_ns && it->second.size == status.st_size) {
+      return it->second.motion;
+    }
+    RCLCPP_INFO(logger, ("Reloading modified file:  " + filePath).c_str());
+    evictLocked(name);
+  }
+
+  std::ifstream ifstream(filePath);
+  if (!ifstream.is_open()) {
+    RCLCPP_ERROR(logger, ("Could not open file:  " + filePath).c_str());
+    return nullptr;
+  }
+  RCLCPP_DEBUG(logger, ("Pos file succesfully loaded from " + filePath).c_str());
+
+  auto lines = parser::readLines(ifstream);
+  std::pmr::monotonic_buffer_resource scratch(upstream_);
+  auto parseResult = parser::parse(lines, &scratch);
+  if (!parseResult.successful) {
+    RCLCPP_ERROR(logger, ("Could not parse file:  " + filePath).c_str());
+    return nullptr;
+  }
+
+  auto motion = Motion::fromKeyFrames(parseResult.keyFrames, upstream_, pool_);
+  if (check_self_collision_) {
+    auto contacts = collision::check(*motion);
+    collision::dropKnown(contacts, parseResult.knownContacts);
+    for (const auto & contact : contacts) {
+      RCLCPP_WARN(logger, "%s: %s", filePath.c_str(), collision::describe(contact).c_str());
+    }
+  }
+  if (check_stability_) {
+    auto segments = std::make_shared<const std::vector<stability::Segment>>(
+      stability::analyze(*motion));
+    for (const auto & segment : *segments) {
+      if (!segment.stable()) {
+        RCLCPP_WARN(logger, "%s: %s", filePath.c_str(), stability::describe(segment).c_str());
+      }
+    }
+    stability_.emplace(name, std::move(segments));
+  }
+  motions_.emplace(name, Loaded{motion, mtime_ns, status.st_size});
+  key_frame_index_.reset();
+  return motion;
+}
+
+std::shared_ptr<const Motion> MotionStore::findLoaded(const std::string & name)
+{
+  if (auto motion = findEmbedded(name)) {
+    return motion;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = motions_.find(name);
+  return it != motions_.end() ? it->second.motion : nullptr;
+}
+
+void MotionStore::evict(const std::string & name)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  evictLocked(name);
+}
+
+void MotionStore::evictLocked(const std::string & name)
+{
+  if (motions_.erase(name) == 0) {
+    return;
+  }
+  stability_.erase(name);
+  // The index holds the evicted motion
+  key_frame_index_.reset();
+}
+
+std::shared_ptr<const std::vector<stability::Segment>> MotionStore::stability(
+  const std::string & name)
+{
+  auto motion = load(name);
+  if (!motion) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto & segments = stability_[name];
+  if (!segments) {
+    segments = std::make_shared<const std::vector<stability::Segment>>(
+      stability::analyze(*motion));
+  }
+  return segments;
+}
+
+std::shared_ptr<const KeyFrameIndex> MotionStore::keyFrameIndex()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!key_frame_index_) {
+    std::vector<std::pair<std::string, std::shared_ptr<const Motion>>> motions;
+    for (const auto & [name, loaded] : motions_) {
+      motions.emplace_back(name, loaded.motion);
+    }
+    std::sort(motions.begin(), motions.end());
+    for (const auto * entry = embedded::motions; entry->name; ++entry) {
+      motions.emplace_back(entry->name, findEmbedded(entry->name));
+    }
+    key_frame_index_ = std::make_shared<const KeyFrameIndex>(motions);
+  }
+  return key_frame_index_;
+}
+
+std::string MotionStore::getFullFilePath(const std::string & filename) const
+{
+  fs::path dir_path(pos_directory_);
+  fs::path file_path(filename);
+  fs::path full_path = dir_path / file_path;
+  return full_path.string();
+}
+
+}  // namespace motion
@@ -115,6 +115,28 @@ void NaoPosActionClient::feedback_callback(GoalHandlePosAction::SharedPtr,
 
 void NaoPosActionClient::result_callback(const GoalHandlePosAction::WrappedResult & result)
 {
+  const auto & report = *result.result;
+  RCLCPP_INFO(
+    this->get_logger(),
+    "Execution report: %u ticks at %.1f Hz, tick latency max %.0f us p99 %.0f us, "
+    "%u deadline misses, max tracking error head %.3f larm %.3f rarm %.3f lleg %.3f rleg %.3f",
+    report.ticks, report.command_rate_hz, report.max_tick_latency_us, report.p99_tick_latency_us,
+    report.deadline_misses, report.max_tracking_error[PosAction::Result::GROUP_HEAD],
+    report.max_tracking_error[PosAction::Result::GROUP_LEFT_ARM],
+    report.max_tracking_error[PosAction::Result::GROUP_RIGHT_ARM],
+    report.max_tracking_error[PosAction::Result::GROUP_LEFT_LEG],
+    report.max_tracking_error[PosAction::Result::GROUP_RIGHT_LEG]);
+  // Only reported by servers counting with perf_counters
+  if (report.mean_tick_cycles > 0) {
+    RCLCPP_INFO(
+      this->get_logger(),
+      "Tick counters: %.0f cycles, %.0f instructions (%.2f per cycle), %.1f cache misses, "
+      "%.1f branch misses",
+      report.mean_tick_cycles, report.mean_tick_instructions,
+      report.mean_tick_instructions / report.mean_tick_cycles, report.mean_tick_cache_misses,
+      report.mean_tick_branch_misses);
+  }
+
   switch (result.code) {
     case rclcpp_action::ResultCode::SUCCEEDED:
       RCLCPP_INFO(this->get_logger(), "Joints posisitions regulary played.");
@@ -15,38 +15,163 @@
 #include "nao_pos_server/nao_pos_action_server.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
-#include "ament_index_cpp/get_package_share_directory.hpp"
-#include "boost/filesystem.hpp"
-#include "indexes.hpp"
-#include "parser.hpp"
 #include "rclcpp/rclcpp.hpp"
-
-namespace fs = boost::filesystem;
+#include "rclcpp/strategies/message_pool_memory_strategy.hpp"
+#include "script.hpp"
 
 namespace nao_pos_action_server_ns
 {
 
+// The executor hands the sensor subscription one sample at a time and gets the message back
+// before taking the next one, so a single preallocated message serves every delivery
+using SensorMessagePool =
+  rclcpp::strategies::message_pool_memory_strategy::MessagePoolMemoryStrategy<
+  nao_lola_sensor_msgs::msg::JointPositions, 1>;
+
+static int64_t systemNowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 NaoPosActionServer::NaoPosActionServer(const rclcpp::NodeOptions & options)
 : rclcpp::Node{"nao_pos_action_server_node", options}, pos_in_action_(false)
 {
+  motion_store_ = std::make_shared<motion::MotionStore>();
+
+  auto param_desc = rcl_interfaces::msg::ParameterDescriptor{};
+  param_desc.description =
+    "A tick starting later than this after the previous one counts as a deadline miss";
+  tick_deadline_ms_ = this->declare_parameter<double>("tick_deadline_ms", 18.0, param_desc);
+  param_desc.description =
+    "Start a goal from the keyframe nearest to the sensed pose when it is closer than this RMS "
+    "joint error (rad), e.g. to resume an interrupted getup, 0 disables";
+  resume_max_distance_ = this->declare_parameter<double>("resume.max_distance", 0.0, param_desc);
+
+  param_desc.description =
+    "Count the cycles, instructions, cache misses and branch misses of every tick with "
+    "perf_event_open and report their means in the result. Nothing is reported for the counters "
+    "the CPU or the kernel do not support";
+  if (this->declare_parameter<bool>("perf_counters", false, param_desc)) {
+    perf_counters_ = std::make_unique<stats::PerfCounters>();
+    if (!perf_counters_->anyAvailable()) {
+      RCLCPP_WARN(this->get_logger(), "No hardware performance counter available");
+    }
+  }
+
+  param_desc.description =
+    "Check the motions loaded from pos files for arm self collisions and log the contacts";
+  motion_store_->setSelfCollisionCheck(
+    this->declare_parameter<bool>("check_self_collision", false, param_desc));
+  param_desc.description =
+    "Check the static stability of the motions loaded from pos files and log unstable segments";
+  motion_store_->setStabilityCheck(
+    this->declare_parameter<bool>("check_stability", false, param_desc));
+
+  param_desc.description =
+    "Tracking error (rad) above which the timeline is slowed down until the joints catch up, "
+    "0 disables";
+  tracking_slowdown_error_ =
+    this->declare_parameter<double>("tracking.slowdown_error", 0.0, param_desc);
+  param_desc.description = "Slowest timeline speed while slowing down, as fraction of real time";
+  tracking_min_time_scale_ =
+    this->declare_parameter<double>("tracking.min_time_scale", 0.25, param_desc);
+  param_desc.description =
+    "Tracking error (rad) above which a still growing error aborts the goal, 0 disables";
+  tracking_abort_error_ = this->declare_parameter<double>("tracking.abort_error", 0.0, param_desc);
+  param_desc.description =
+    "Consecutive ticks the error must keep growing above tracking.abort_error to abort the goal";
+  tracking_abort_ticks_ = std::max<int64_t>(
+    1, this->declare_parameter<int64_t>("tracking.abort_ticks", 10, param_desc));
+
+  param_desc.description =
+    "Fixed delay (ms) between a published command and the actuators (LoLA bridge + DCM cycle). "
+    "The motion is evaluated this much ahead of the tick time";
+  lookahead_pipeline_latency_ms_ =
+    this->declare_parameter<double>("lookahead.pipeline_latency_ms", 0.0, param_desc);
+  param_desc.description =
+    "Also look ahead by the measured delivery latency of the sensor messages, assuming commands "
+    "take as long to reach the robot";
+  lookahead_delivery_latency_ =
+    this->declare_parameter<bool>("lookahead.delivery_latency", false, param_desc);
+
+  param_desc.description =
+    "Publish only the joints whose commanded position moved by more than this (rad) since they "
+    "were last published, and stiffnesses only when they change. 0 publishes every joint at "
+    "every tick";
+  output_delta_epsilon_ = this->declare_parameter<double>("output.delta_epsilon", 0.0, param_desc);
+  param_desc.description =
+    "With output.delta_epsilon, ticks between two commands carrying every joint";
+  output_full_refresh_ticks_ = std::max<int64_t>(
+    1, this->declare_parameter<int64_t>("output.full_refresh_ticks", 20, param_desc));
+
+  param_desc.description =
+    "Flight recorder file, a ring of the last sensor samples and published commands. Empty "
+    "records to /tmp/<node namespace and name>.rec";
+  auto recorder_file = this->declare_parameter<std::string>("recorder.file", "", param_desc);
+  param_desc.description =
+    "Records kept by the flight recorder, 144 bytes each. Playing at the LoLA rate takes about "
+    "250 records per second. 0 disables the recorder";
+  auto recorder_capacity =
+    this->declare_parameter<int64_t>("recorder.capacity", 30000, param_desc);
+  if (recorder_capacity > 0) {
+    if (recorder_file.empty()) {
+      std::string name = std::string(this->get_fully_qualified_name()).substr(1);
+      std::replace(name.begin(), name.end(), '/', '_');
+      recorder_file = "/tmp/" + name + ".rec";
+    }
+    recorder_ = recorder::FlightRecorder::create(recorder_file, recorder_capacity);
+    if (recorder_) {
+      RCLCPP_INFO(this->get_logger(), "Flight recorder writing to %s", recorder_file.c_str());
+    } else {
+      RCLCPP_ERROR(
+        this->get_logger(), "Could not open flight recorder file %s: %s", recorder_file.c_str(),
+        std::strerror(errno));
+    }
+  }
+
   pub_joint_positions_ = create_publisher<nao_lola_command_msgs::msg::JointPositions>(
     "/effectors/joint_positions", rclcpp::SensorDataQoS());
   pub_joint_stiffnesses_ = create_publisher<nao_lola_command_msgs::msg::JointStiffnesses>(
     "/effectors/joint_stiffnesses", rclcpp::SensorDataQoS());
 
+  param_desc.description =
+    "How sensor samples reach the tick. executor: subscription callback dispatched by the "
+    "executor. waitset: a dedicated thread waits on the subscription only, takes the sample and "
+    "publishes the command in the same iteration. event: the middleware new message listener "
+    "wakes a dedicated thread, which ticks with the freshest sample";
+  tick_mode_ = this->declare_parameter<std::string>("tick_mode", "executor", param_desc);
+
+  rclcpp::SubscriptionOptions sub_options;
+  if (tick_mode_ != "executor") {
+    // Keep the subscription away from the executor, the tick thread takes its samples
+    sensor_callback_group_ =
+      create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive, false);
+    sub_options.callback_group = sensor_callback_group_;
+    // take() only sees samples delivered by the middleware, not intra-process ones
+    sub_options.use_intra_process_comm = rclcpp::IntraProcessSetting::Disable;
+  }
+
   sub_joint_states_ = create_subscription<nao_lola_sensor_msgs::msg::JointPositions>(
     "/sensors/joint_positions", rclcpp::SensorDataQoS(),
-    [this](nao_lola_sensor_msgs::msg::JointPositions::SharedPtr sensor_joints) {
-      if (pos_in_action_) {
-        calculateEffectorJoints(*sensor_joints);
-      }
-    });
+    [this](
+      nao_lola_sensor_msgs::msg::JointPositions::SharedPtr sensor_joints,
+      const rclcpp::MessageInfo & message_info) {
+      onJointPositions(*sensor_joints, message_info);
+    },
+    sub_options, std::make_shared<SensorMessagePool>());
 
   action_server_ = rclcpp_action::create_server<nao_pos_interfaces::action::PosPlay>(
     this, "nao_pos_action",
@@ -54,208 +179,433 @@ NaoPosActionServer::NaoPosActionServer(const rclcpp::NodeOptions & options)
     std::bind(&NaoPosActionServer::handleCancel, this, std::placeholders::_1),
     std::bind(&NaoPosActionServer::handleAccepted, this, std::placeholders::_1));
 
+  script_player_ = std::make_unique<script::Player>();
+  script_player_->start = [this](const char * name) {
+      // Prepared by handleAccepted
+      for (const auto & prepared : prepared_motions_) {
+        if (prepared.name == name) {
+          startMotion(prepared);
+          initial_time_ = tick_time_;
+          return true;
+        }
+      }
+      return false;
+    };
+  script_player_->playing = [this]() {return !motion_finished_;};
+  script_player_->trackingError = [this]() {return script_tracking_error_;};
+
+  // Every buffer startMotion sizes can hold all the joints, starting a motion never allocates
+  constexpr std::size_t numJoints = nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS;
+  for (auto * values : {&start_positions_, &unshifted_positions_, &unshifted_stiffnesses_,
+      &published_positions_, &published_stiffnesses_, &effector_joints_.positions,
+      &effector_joints_stiff_.stiffnesses, &delta_joints_.positions,
+      &delta_joints_stiff_.stiffnesses})
+  {
+    values->reserve(numJoints);
+  }
+  for (auto * indexes : {&effector_joints_.indexes, &effector_joints_stiff_.indexes,
+      &delta_joints_.indexes, &delta_joints_stiff_.indexes})
+  {
+    indexes->reserve(numJoints);
+  }
+
+  if (tick_mode_ == "waitset") {
+    tick_thread_ = std::thread(&NaoPosActionServer::waitSetLoop, this);
+  } else if (tick_mode_ == "event") {
+    // Called from a middleware thread, only signals the tick thread
+    sub_joint_states_->set_on_new_message_callback(
+      [this](std::size_t count) {
+        {
+          std::lock_guard<std::mutex> lock(new_samples_mutex_);
+          new_samples_ += count;
+        }
+        new_samples_cv_.notify_one();
+      });
+    tick_thread_ = std::thread(&NaoPosActionServer::eventLoop, this);
+  } else if (tick_mode_ != "executor") {
+    RCLCPP_ERROR(
+      this->get_logger(), "Unknown tick_mode '%s', sensor samples will not be processed",
+      tick_mode_.c_str());
+  }
+
   RCLCPP_INFO(this->get_logger(), "nao_pos_action_server_node initialized");
 }
 
-NaoPosActionServer::~NaoPosActionServer() {}
+NaoPosActionServer::~NaoPosActionServer()
+{
+  if (tick_mode_ == "event") {
+    sub_joint_states_->clear_on_new_message_callback();
+  }
+  {
+    std::lock_guard<std::mutex> lock(new_samples_mutex_);
+    tick_thread_running_ = false;
+  }
+  new_samples_cv_.notify_one();
+  if (tick_thread_.joinable()) {
+    tick_thread_.join();
+  }
+}
 
-void NaoPosActionServer::readPosFile(std::string & filePath)
+void NaoPosActionServer::waitSetLoop()
 {
-  std::ifstream ifstream(filePath);
-  if (ifstream.is_open()) {
-    RCLCPP_DEBUG(this->get_logger(), ("Pos file succesfully loaded from " + filePath).c_str());
-    file_successfully_read_ = true;
-    auto lines = readLines(ifstream);
-    auto parseResult = parser::parse(lines);
-    file_successfully_read_ = parseResult.successful;
-    key_frames_ = parseResult.keyFrames;
-  } else {
-    RCLCPP_ERROR(this->get_logger(), ("Could not open file:  " + filePath).c_str());
-    file_successfully_read_ = false;
+  rclcpp::WaitSet wait_set;
+  wait_set.add_subscription(sub_joint_states_);
+
+  nao_lola_sensor_msgs::msg::JointPositions sensor_joints;
+  rclcpp::MessageInfo message_info;
+
+  while (tick_thread_running_ && rclcpp::ok(this->get_node_base_interface()->get_context())) {
+    // Wake up regularly to notice shutdown
+    auto wait_result = wait_set.wait(std::chrono::milliseconds(100));
+    if (wait_result.kind() != rclcpp::WaitResultKind::Ready) {
+      continue;
+    }
+    while (sub_joint_states_->take(sensor_joints, message_info)) {
+      onJointPositions(sensor_joints, message_info);
+    }
   }
 }
 
-std::string NaoPosActionServer::getFullFilePath(std::string & filename)
+void NaoPosActionServer::eventLoop()
 {
-  std::string file = "pos/" + filename;
-  std::string package_share_directory =
-    ament_index_cpp::get_package_share_directory("nao_pos_server");
-
-  fs::path dir_path(package_share_directory);
-  fs::path file_path(file);
-  fs::path full_path = dir_path / file_path;
-  return full_path.string();
+  nao_lola_sensor_msgs::msg::JointPositions sensor_joints;
+  rclcpp::MessageInfo message_info;
+
+  while (tick_thread_running_ && rclcpp::ok(this->get_node_base_interface()->get_context())) {
+    {
+      // Wake up regularly to notice shutdown
+      std::unique_lock<std::mutex> lock(new_samples_mutex_);
+      new_samples_cv_.wait_for(
+        lock, std::chrono::milliseconds(100),
+        [this]() {return new_samples_ > 0 || !tick_thread_running_;});
+      new_samples_ = 0;
+    }
+
+    // If the tick fell behind, older samples are dropped: the command follows the freshest one
+    bool taken = false;
+    while (sub_joint_states_->take(sensor_joints, message_info)) {
+      taken = true;
+    }
+    if (taken) {
+      onJointPositions(sensor_joints, message_info);
+    }
+  }
 }
 
-std::vector<std::string> NaoPosActionServer::readLines(std::ifstream & ifstream)
+void NaoPosActionServer::onJointPositions(
+  nao_lola_sensor_msgs::msg::JointPositions & sensor_joints,
+  const rclcpp::MessageInfo & message_info)
 {
-  std::vector<std::string> ret;
+  auto tick_start = sampleReceivedTime(message_info);
+  measureDeliveryLatency(message_info);
+  // Time of the tick, recorded with the sample so that replays tick at the same time
+  rclcpp::Time now = rclcpp::Node::now();
+  if (recorder_) {
+    recorder_->record(
+      recorder::Kind::SensorPositions, now.nanoseconds(), sensor_joints.positions.data(),
+      sensor_joints.positions.size());
+  }
 
-  while (!ifstream.eof()) {
-    std::string line;
-    std::getline(ifstream, line);
-    ret.push_back(line);
+  if (pos_in_action_) {
+    // Goal callbacks may run concurrently when the tick has its own thread
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pos_in_action_) {
+      calculateEffectorJoints(sensor_joints, now, tick_start);
+    }
   }
+}
 
-  return ret;
+void NaoPosActionServer::processSample(nao_lola_sensor_msgs::msg::JointPositions & sensor_joints)
+{
+  onJointPositions(sensor_joints, rclcpp::MessageInfo{});
 }
 
-float NaoPosActionServer::findElem(
-  const std::vector<uint8_t> & indexes, const std::vector<float> & data, uint8_t joint)
+stats::ExecutionStats::Clock::time_point NaoPosActionServer::sampleReceivedTime(
+  const rclcpp::MessageInfo & message_info)
 {
-  for (uint8_t a = 0; a < indexes.size(); a++) {
-    if (indexes.at(a) == joint) {
-      return data.at(a);
-    }
+  auto steady_now = stats::ExecutionStats::Clock::now();
+
+  // Middlewares that stamp the reception let the latency include the time the sample waited
+  // to be dispatched, otherwise it starts when the sample reaches the tick
+  auto received_ns = message_info.get_rmw_message_info().received_timestamp;
+  if (received_ns == 0) {
+    return steady_now;
   }
-  return NAN;
+  auto waited = std::chrono::nanoseconds(std::max<int64_t>(0, systemNowNs() - received_ns));
+  return steady_now - std::chrono::duration_cast<stats::ExecutionStats::Clock::duration>(waited);
 }
 
 void NaoPosActionServer::calculateEffectorJoints(
-  nao_lola_sensor_msgs::msg::JointPositions & sensor_joints)
+  nao_lola_sensor_msgs::msg::JointPositions & sensor_joints, const rclcpp::Time & now,
+  stats::ExecutionStats::Clock::time_point tick_start)
 {
-  //std::lock_guard<std::mutex> lock(mutex_);
+  tick_time_ = now;
 
-  if (goal_handle_->is_canceling()) {
+  if (cancel_requested_) {
+    if (!goal_handle_->is_canceling()) {
+      // handleCancel returned but the goal is not canceling yet: publish nothing meanwhile
+      return;
+    }
+    // Completed here with the report of the ticks played so far
+    cancel_requested_ = false;
+    pos_in_action_ = false;
     auto result = std::make_shared<nao_pos_interfaces::action::PosPlay::Result>();
     result->success = false;
+    stats_.fillResult(*result);
     goal_handle_->canceled(result);
+    goal_handle_.reset();
     RCLCPP_DEBUG(this->get_logger(), "pos action goal canceled");
     return;
   }
 
-  int time_ms = (rclcpp::Node::now() - initial_time_).nanoseconds() / 1e6;
+  if (now < initial_time_) {
+    // Armed, waiting for the requested start_time
+    return;
+  }
+
+  if (script_) {
+    script_tracking_error_ = commandError(sensor_joints);
+    // The script resumes before the motion is evaluated, so the motion it starts is
+    // commanded from this very tick
+    if (!script_->tick()) {
+      bool success = !script_->failed();
+      script_.reset();
+      pos_in_action_ = false;
+      auto result = std::make_shared<nao_pos_interfaces::action::PosPlay::Result>();
+      result->success = success;
+      stats_.fillResult(*result);
+      if (success) {
+        goal_handle_->succeed(result);
+      } else {
+        goal_handle_->abort(result);
+        RCLCPP_ERROR(this->get_logger(), "pos script failed");
+      }
+      return;
+    }
+    if (motion_finished_) {
+      // The script waits for something else than a motion
+      return;
+    }
+  }
+
+  // Counted from here: the ticks returning above publish nothing and never reach stop
+  if (perf_counters_) {
+    perf_counters_->start();
+  }
 
-  if (posFinished(time_ms)) {
+  if (firstTickSinceActionStarted_) {
+    timeline_ms_ = (now - initial_time_).nanoseconds() / 1e6 + resumeTimeMs(sensor_joints);
+  } else {
+    float tracking_error = stats_.recordTrackingError(
+      last_command_->indexes.data(), last_command_->indexes.size(), tracked_positions_,
+      sensor_joints.positions.data());
+
+    if (!superviseTracking(tracking_error)) {
+      pos_in_action_ = false;
+      auto result = std::make_shared<nao_pos_interfaces::action::PosPlay::Result>();
+      result->success = false;
+      stats_.fillResult(*result);
+      goal_handle_->abort(result);
+      script_.reset();
+      RCLCPP_ERROR(
+        this->get_logger(), "pos action aborted, tracking error %.3f rad keeps growing",
+        tracking_error);
+      return;
+    }
+
+    // The timeline runs slower than the clock while the joints lag behind the commands
+    timeline_ms_ += (now - last_tick_time_).nanoseconds() / 1e6 * time_scale_;
+  }
+  last_tick_time_ = now;
+  float time_ms = timeline_ms_;
+
+  // Commands reach the actuators later than now, so evaluate where the motion will be by then.
+  // Past the end this holds the last keyframe, finishing still follows the unshifted timeline.
+  float lookahead_ms = lookahead_pipeline_latency_ms_;
+  if (lookahead_delivery_latency_) {
+    lookahead_ms += delivery_latency_ms_;
+  }
+  float evaluation_ms = time_ms + lookahead_ms * time_scale_;
+
+  if (motion_->finished(time_ms)) {
+    motion_finished_ = true;
+    if (script_) {
+      // The script resumes at the next tick
+      return;
+    }
     // We've finished the motion, set to DONE
     pos_in_action_ = false;
     auto result = std::make_shared<nao_pos_interfaces::action::PosPlay::Result>();
     result->success = true;
+    stats_.fillResult(*result);
     goal_handle_->succeed(result);
     RCLCPP_DEBUG(this->get_logger(), "Pos finished");
     return;
   }
 
   if (firstTickSinceActionStarted_) {
-    nao_lola_command_msgs::msg::JointPositions command;
-    command.indexes = indexes::indexes;
-    command.positions =
-      std::vector<float>(sensor_joints.positions.begin(), sensor_joints.positions.end());
-    key_frame_start_ =
-      std::make_unique<KeyFrame>(0, command, nao_lola_command_msgs::msg::JointStiffnesses{});
-  }
-
-  const auto & previousKeyFrame = findPreviousKeyFrame(time_ms);
-  const auto & nextKeyFrame = findNextKeyFrame(time_ms);
-
-  if (firstTickSinceActionStarted_) {
-    for (auto i : nextKeyFrame.positions.indexes) {
-      selected_joints_.push_back(i);
+    // The sensed pose is the start keyframe of the motion, at t = 0
+    const auto & joints = motion_->joints();
+    for (std::size_t j = 0; j < joints.size(); ++j) {
+      start_positions_[j] = sensor_joints.positions[joints[j]];
     }
+    segment_ = 0;
     firstTickSinceActionStarted_ = false;
-
     RCLCPP_DEBUG(this->get_logger(), "first tick false");
-    /*std::string s1="";
-    for (unsigned c = 0; c < selected_joints_.size(); c++) {
-        s1.append( std::to_string(selected_joints_.at(c))+", " );
-    }
-    RCLCPP_INFO(this->get_logger(), ("selected_joints_: "+s1).c_str() );*/
   }
 
-  float timeFromPreviousKeyFrame = time_ms - previousKeyFrame.t_ms;
-  float timeToNextKeyFrame = nextKeyFrame.t_ms - time_ms;
-  float duration = timeFromPreviousKeyFrame + timeToNextKeyFrame;
+  segment_ = motion_->segmentFrom(segment_, evaluation_ms);
 
-  RCLCPP_DEBUG(
-    this->get_logger(), ("timeFromPreviousKeyFrame, timeToNextKeyFrame, duration: " +
-                         std::to_string(timeFromPreviousKeyFrame) + ", " +
-                         std::to_string(timeToNextKeyFrame) + ", " + std::to_string(duration))
-                          .c_str());
+  if (motion_->isHold(segment_)) {
+    // Nothing to compute, the command was built when the goal was accepted
+    publishCommand(playing_->hold_positions[segment_], playing_->hold_stiffnesses[segment_]);
+  } else {
+    float beta = motion_->beta(segment_, evaluation_ms);
 
-  float alpha = timeToNextKeyFrame / duration;  // normalized coefficent k of convex combination
-  float beta = timeFromPreviousKeyFrame / duration;  // normalized 1-k
+    RCLCPP_DEBUG(
+      this->get_logger(),
+      ("segment, beta: " + std::to_string(segment_) + ", " + std::to_string(beta)).c_str());
 
-  RCLCPP_DEBUG(
-    this->get_logger(),
-    ("alpha, beta: " + std::to_string(alpha) + ", " + std::to_string(beta)).c_str());
-
-  nao_lola_command_msgs::msg::JointPositions effector_joints;
-  nao_lola_command_msgs::msg::JointStiffnesses effector_joints_stiff;
-
-  float nextPos = NAN, previousPos = NAN, nextStiff = NAN;
-  float tmp = NAN;
-
-  for (uint8_t i : selected_joints_) {
-    nextPos = this->findElem(nextKeyFrame.positions.indexes, nextKeyFrame.positions.positions, i);
-    nextStiff =
-      this->findElem(nextKeyFrame.stiffnesses.indexes, nextKeyFrame.stiffnesses.stiffnesses, i);
-    previousPos =
-      this->findElem(previousKeyFrame.positions.indexes, previousKeyFrame.positions.positions, i);
-
-    tmp = previousPos * alpha + nextPos * beta;
-    if (tmp != NAN) {
-      effector_joints.indexes.push_back(i);
-      effector_joints.positions.push_back(tmp);
-    } else {
-      RCLCPP_ERROR(this->get_logger(), "NAN position");
-      return;
-    }
-    if (nextStiff != NAN) {
-      effector_joints_stiff.indexes.push_back(i);
-      effector_joints_stiff.stiffnesses.push_back(nextStiff);
-    } else {
-      RCLCPP_ERROR(this->get_logger(), "NAN stiffness");
-      return;
-    }
+    motion_->interpolate(
+      segment_, beta, start_positions_.data(), effector_joints_.positions.data(),
+      effector_joints_stiff_.stiffnesses.data());
 
-    nextPos = NAN, previousPos = NAN, nextStiff = NAN;
+    publishCommand(effector_joints_, effector_joints_stiff_);
   }
-
-  pub_joint_positions_->publish(effector_joints);
-  pub_joint_stiffnesses_->publish(effector_joints_stiff);
+  trackUnshiftedPose(time_ms, evaluation_ms);
+  if (perf_counters_) {
+    stats_.recordPerfCounters(perf_counters_->stop());
+  }
+  stats_.recordTick(tick_start, stats::ExecutionStats::Clock::now());
   RCLCPP_DEBUG(
     this->get_logger(), "published to /effectors/joint_positions and /effectors/joint_stiffnesses");
 }
 
-const KeyFrame & NaoPosActionServer::findPreviousKeyFrame(int time_ms)
+void NaoPosActionServer::trackUnshiftedPose(float time_ms, float evaluation_ms)
 {
-  for (auto it = key_frames_.rbegin(); it != key_frames_.rend(); ++it) {
-    const auto & keyFrame = *it;
-    int keyFrameDeadline = keyFrame.t_ms;
-    if (time_ms >= keyFrameDeadline) {
-      return keyFrame;
-    }
+  if (evaluation_ms == time_ms) {
+    tracked_positions_ = last_command_->positions.data();
+    return;
+  }
+  // The command leads the motion by the look-ahead, the joints are expected to follow the
+  // motion itself
+  tracked_segment_ = motion_->segmentFrom(tracked_segment_, time_ms);
+  if (motion_->isHold(tracked_segment_)) {
+    tracked_positions_ = motion_->positions(tracked_segment_);
+    return;
+  }
+  motion_->interpolate(
+    tracked_segment_, motion_->beta(tracked_segment_, time_ms), start_positions_.data(),
+    unshifted_positions_.data(), unshifted_stiffnesses_.data());
+  tracked_positions_ = unshifted_positions_.data();
+}
+
+void NaoPosActionServer::measureDeliveryLatency(const rclcpp::MessageInfo & message_info)
+{
+  // Not every middleware stamps the samples at the source
+  auto source_ns = message_info.get_rmw_message_info().source_timestamp;
+  if (source_ns == 0) {
+    return;
   }
 
-  return *key_frame_start_;
+  float latency_ms = (systemNowNs() - source_ns) / 1e6;
+
+  // Ignore samples that are obviously skewed by unsynchronized clocks
+  if (latency_ms < 0 || latency_ms > MAX_DELIVERY_LATENCY_MS) {
+    return;
+  }
+  delivery_latency_ms_ += DELIVERY_LATENCY_SMOOTHING * (latency_ms - delivery_latency_ms_);
 }
 
-const KeyFrame & NaoPosActionServer::findNextKeyFrame(int time_ms)
+void NaoPosActionServer::publishCommand(
+  const nao_lola_command_msgs::msg::JointPositions & positions,
+  const nao_lola_command_msgs::msg::JointStiffnesses & stiffnesses)
 {
-  for (const auto & keyFrame : key_frames_) {
-    int keyFrameDeadline = keyFrame.t_ms;
-    if (time_ms < keyFrameDeadline) {
-      return keyFrame;
+  last_command_ = &positions;
+
+  if (output_delta_epsilon_ <= 0.0) {
+    publishPositions(positions);
+    publishStiffnesses(stiffnesses);
+    return;
+  }
+
+  // The first command of a goal is always a full one
+  const std::size_t numJoints = positions.indexes.size();
+  if (ticks_since_full_command_ == 0 || ticks_since_full_command_ >= output_full_refresh_ticks_) {
+    publishPositions(positions);
+    publishStiffnesses(stiffnesses);
+    std::copy_n(positions.positions.begin(), numJoints, published_positions_.begin());
+    std::copy_n(stiffnesses.stiffnesses.begin(), numJoints, published_stiffnesses_.begin());
+    ticks_since_full_command_ = 1;
+    return;
+  }
+  ++ticks_since_full_command_;
+
+  // Capacity was reserved at construction, clearing keeps it
+  delta_joints_.indexes.clear();
+  delta_joints_.positions.clear();
+  delta_joints_stiff_.indexes.clear();
+  delta_joints_stiff_.stiffnesses.clear();
+  for (std::size_t j = 0; j < numJoints; ++j) {
+    if (std::fabs(positions.positions[j] - published_positions_[j]) > output_delta_epsilon_) {
+      delta_joints_.indexes.push_back(positions.indexes[j]);
+      delta_joints_.positions.push_back(positions.positions[j]);
+      published_positions_[j] = positions.positions[j];
+    }
+    if (stiffnesses.stiffnesses[j] != published_stiffnesses_[j]) {
+      delta_joints_stiff_.indexes.push_back(stiffnesses.indexes[j]);
+      delta_joints_stiff_.stiffnesses.push_back(stiffnesses.stiffnesses[j]);
+      published_stiffnesses_[j] = stiffnesses.stiffnesses[j];
     }
   }
 
-  RCLCPP_ERROR(this->get_logger(), "findKeyFrame: Should never reach here");
-  return key_frames_.back();
+  if (!delta_joints_.indexes.empty()) {
+    publishPositions(delta_joints_);
+  }
+  if (!delta_joints_stiff_.indexes.empty()) {
+    publishStiffnesses(delta_joints_stiff_);
+  }
 }
 
-bool NaoPosActionServer::posFinished(int time_ms)
+void NaoPosActionServer::publishPositions(const nao_lola_command_msgs::msg::JointPositions & msg)
 {
-  if (key_frames_.size() == 0) {
-    return true;
+  pub_joint_positions_->publish(msg);
+  if (recorder_) {
+    recorder_->record(
+      recorder::Kind::CommandPositions, tick_time_.nanoseconds(), msg.indexes.data(),
+      msg.positions.data(), msg.indexes.size());
   }
+}
 
-  const auto lastKeyFrame = key_frames_.back();
-  int lastKeyFrameTime = lastKeyFrame.t_ms;
-  if (time_ms >= lastKeyFrameTime) {
-    return true;
+void NaoPosActionServer::publishStiffnesses(
+  const nao_lola_command_msgs::msg::JointStiffnesses & msg)
+{
+  pub_joint_stiffnesses_->publish(msg);
+  if (recorder_) {
+    recorder_->record(
+      recorder::Kind::CommandStiffnesses, tick_time_.nanoseconds(), msg.indexes.data(),
+      msg.stiffnesses.data(), msg.indexes.size());
   }
+}
 
-  return false;
+bool NaoPosActionServer::superviseTracking(float tracking_error)
+{
+  if (tracking_slowdown_error_ > 0 && tracking_error > tracking_slowdown_error_) {
+    time_scale_ = std::max(tracking_min_time_scale_, tracking_slowdown_error_ / tracking_error);
+  } else {
+    time_scale_ = 1.0f;
+  }
+
+  if (tracking_abort_error_ > 0 && tracking_error > tracking_abort_error_ &&
+    tracking_error > previous_tracking_error_)
+  {
+    ++growing_error_ticks_;
+  } else {
+    growing_error_ticks_ = 0;
+  }
+  previous_tracking_error_ = tracking_error;
+
+  return growing_error_ticks_ < tracking_abort_ticks_;
 }
 
 rclcpp_action::GoalResponse NaoPosActionServer::handleGoal(
@@ -268,12 +618,26 @@ rclcpp_action::GoalResponse NaoPosActionServer::handleGoal(
   (void)uuid;
   (void)goal;
 
+  rclcpp::Time start_time(goal->start_time, this->get_clock()->get_clock_type());
+  if (start_time.nanoseconds() != 0 && start_time < rclcpp::Node::now()) {
+    RCLCPP_ERROR(get_logger(), "Requested start_time is in the past");
+    return rclcpp_action::GoalResponse::REJECT;
+  }
+
   if (!pos_in_action_) {
-    std::string filename = goal->action_name + ".pos";
-    std::string path = getFullFilePath(filename);
-    readPosFile(path);
-    RCLCPP_INFO(get_logger(), ("found pos file:  " + path).c_str());
-    if (file_successfully_read_) {
+    if (const script::Entry * entry = findScript(goal->action_name)) {
+      // Scripts start motions from the playback thread, which must find them already loaded
+      for (const auto & name : entry->motions) {
+        if (!motion_store_->load(name)) {
+          return rclcpp_action::GoalResponse::REJECT;
+        }
+      }
+      return rclcpp_action::GoalResponse::ACCEPT_AND_EXECUTE;
+    }
+
+    motion_ = motion_store_->load(goal->action_name);
+    if (motion_) {
+      RCLCPP_INFO(get_logger(), ("found pos file:  " + goal->action_name + ".pos").c_str());
       return rclcpp_action::GoalResponse::ACCEPT_AND_EXECUTE;
     }
   }
@@ -288,8 +652,13 @@ rclcpp_action::CancelResponse NaoPosActionServer::handleCancel(
   std::lock_guard<std::mutex> lock(mutex_);
   RCLCPP_INFO(get_logger(), "Received request to cancel goal");
   (void)goal_handle;
-  pos_in_action_ = false;
-  goal_handle_.reset();
+  if (recorder_) {
+    recorder_->recordGoal(recorder::Kind::GoalCanceled, rclcpp::Node::now().nanoseconds(), "");
+  }
+  // The goal only becomes canceling once accepted: the playback stops now, and the next tick
+  // completes the cancel with the execution report
+  cancel_requested_ = true;
+  script_.reset();
   return rclcpp_action::CancelResponse::ACCEPT;
 }
 
@@ -299,11 +668,137 @@ void NaoPosActionServer::handleAccepted(
 {
   std::lock_guard<std::mutex> lock(mutex_);
   RCLCPP_INFO(this->get_logger(), "Starting Pos Action");
-  initial_time_ = rclcpp::Node::now();
+  rclcpp::Time now = rclcpp::Node::now();
+  rclcpp::Time start_time(goal_handle->get_goal()->start_time, this->get_clock()->get_clock_type());
+  initial_time_ = start_time.nanoseconds() != 0 ? start_time : now;
+
+  const std::string & action_name = goal_handle->get_goal()->action_name;
+  if (recorder_) {
+    recorder_->recordGoal(
+      recorder::Kind::GoalAccepted, now.nanoseconds(), action_name, start_time.nanoseconds());
+  }
+  if (const script::Entry * entry = findScript(action_name)) {
+    // The script starts its first motion from its first tick, and the others from later ticks
+    prepared_motions_.clear();
+    for (const auto & name : entry->motions) {
+      // Loaded by handleGoal
+      if (auto motion = motion_store_->findLoaded(name)) {
+        prepared_motions_.push_back(prepareMotion(name, std::move(motion)));
+      }
+    }
+    script_ = std::make_unique<script::Script>(entry->create());
+    script_->start(script_player_.get());
+    key_frame_index_.reset();
+    motion_.reset();
+    playing_ = nullptr;
+    motion_finished_ = true;
+    last_command_ = &effector_joints_;
+    effector_joints_.indexes.clear();
+    effector_joints_.positions.clear();
+    tracked_positions_ = effector_joints_.positions.data();
+  } else {
+    script_.reset();
+    key_frame_index_ = resume_max_distance_ > 0.0 ? motion_store_->keyFrameIndex() : nullptr;
+    prepared_motions_.clear();
+    prepared_motions_.push_back(prepareMotion(action_name, motion_));
+    startMotion(prepared_motions_.front());
+  }
+  cancel_requested_ = false;
+
+  stats_.reset(
+    std::chrono::duration_cast<stats::ExecutionStats::Clock::duration>(
+      std::chrono::duration<double, std::milli>(tick_deadline_ms_)));
+
+  time_scale_ = 1.0f;
+  previous_tracking_error_ = 0.0f;
+  growing_error_ticks_ = 0;
+
+  goal_handle_ = goal_handle;
   pos_in_action_ = true;
+}
+
+NaoPosActionServer::PreparedMotion NaoPosActionServer::prepareMotion(
+  const std::string & name, std::shared_ptr<const motion::Motion> motion)
+{
+  PreparedMotion prepared{name, std::move(motion), {}, {}};
+  const auto & joints = prepared.motion->joints();
+  std::size_t numKeyFrames = prepared.motion->numKeyFrames();
+  prepared.hold_positions.resize(numKeyFrames);
+  prepared.hold_stiffnesses.resize(numKeyFrames);
+  for (std::size_t k = 0; k < numKeyFrames; ++k) {
+    if (prepared.motion->isHold(k)) {
+      const float * positions = prepared.motion->positions(k);
+      const float * stiffnesses = prepared.motion->stiffnesses(k);
+      prepared.hold_positions[k].indexes.assign(joints.begin(), joints.end());
+      prepared.hold_positions[k].positions.assign(positions, positions + joints.size());
+      prepared.hold_stiffnesses[k].indexes.assign(joints.begin(), joints.end());
+      prepared.hold_stiffnesses[k].stiffnesses.assign(stiffnesses, stiffnesses + joints.size());
+    }
+  }
+  return prepared;
+}
+
+void NaoPosActionServer::startMotion(const PreparedMotion & prepared)
+{
+  playing_ = &prepared;
+  motion_ = prepared.motion;
+  motion_finished_ = false;
   firstTickSinceActionStarted_ = true;
-  selected_joints_.clear();  // std::vector<uint8_t>
-  goal_handle_ = goal_handle;
+
+  const auto & joints = motion_->joints();
+  start_positions_.assign(joints.size(), 0.0f);
+  effector_joints_.indexes.assign(joints.begin(), joints.end());
+  effector_joints_.positions.assign(joints.size(), 0.0f);
+  effector_joints_stiff_.indexes.assign(joints.begin(), joints.end());
+  effector_joints_stiff_.stiffnesses.assign(joints.size(), 0.0f);
+  last_command_ = &effector_joints_;
+  unshifted_positions_.assign(joints.size(), 0.0f);
+  unshifted_stiffnesses_.assign(joints.size(), 0.0f);
+  tracked_positions_ = effector_joints_.positions.data();
+  tracked_segment_ = 0;
+
+  published_positions_.assign(joints.size(), 0.0f);
+  published_stiffnesses_.assign(joints.size(), 0.0f);
+  ticks_since_full_command_ = 0;
+}
+
+float NaoPosActionServer::resumeTimeMs(
+  const nao_lola_sensor_msgs::msg::JointPositions & sensor_joints)
+{
+  if (!key_frame_index_) {
+    return 0.0f;
+  }
+  auto match = key_frame_index_->nearest(*motion_, sensor_joints.positions.data());
+  if (!match || match->keyFrame == 0 || match->distance > resume_max_distance_) {
+    return 0.0f;
+  }
+
+  // The robot is about at this keyframe: skip the segments leading to it
+  RCLCPP_INFO(
+    this->get_logger(), "resuming from keyframe %zu, %.3f rad away", match->keyFrame,
+    match->distance);
+  return motion_->timeMs(match->keyFrame);
+}
+
+float NaoPosActionServer::commandError(
+  const nao_lola_sensor_msgs::msg::JointPositions & sensor_joints) const
+{
+  float error = 0.0f;
+  for (std::size_t j = 0; j < last_command_->indexes.size(); ++j) {
+    error = std::max(
+      error,
+      std::fabs(tracked_positions_[j] - sensor_joints.positions[last_command_->indexes[j]]));
+  }
+  return error;
+}
+
+const script::Entry * NaoPosActionServer::findScript(const std::string & action_name)
+{
+  static const std::string prefix = "script/";
+  if (action_name.compare(0, prefix.size(), prefix) != 0) {
+    return nullptr;
+  }
+  return script::find(action_name.substr(prefix.size()));
 }
 
 }  // namespace nao_pos_action_server_ns
@@ -0,0 +1,189 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Build step generating embedded_motions.cpp: parses pos files and writes their dense tables
+// as constexpr arrays, so that they are linked into nao_pos_server_node and never need to be
+// read or parsed at runtime.
+//
+//   nao_pos_embed <output.cpp> <file.pos>...
+//
+// Keyframe rows are interned in a KeyFramePool, so the rows shared by several embedded motions
+// are written once, in a single rows table.
+// Fails if any file can not be parsed, so a broken critical motion breaks the build, with the
+// parser diagnostics printed as nao_pos_lint does. The self collision precheck and the stability
+// analysis run on every file, contacts the file does not declare known and unstable segments are
+// printed as warnings.
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "nao_pos_server/key_frame_pool.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "nao_pos_server/self_collision.hpp"
+#include "nao_pos_server/stability.hpp"
+#include "parser.hpp"
+#include "rcutils/logging.h"
+
+namespace fs = boost::filesystem;
+
+template<typename T, typename Format>
+static void writeArray(
+  std::ostream & out, const char * type, const std::string & name, const T * values,
+  std::size_t size, Format format)
+{
+  // Zero sized arrays are not allowed, an empty table gets a single unused element
+  out << "constexpr " << type << " " << name << "[] = {";
+  for (std::size_t i = 0; i < size; ++i) {
+    out << (i % 8 == 0 ? "\n  " : " ") << format(values[i]) << ",";
+  }
+  out << (size == 0 ? "{}" : "\n") << "};\n";
+}
+
+static std::string integer(unsigned value)
+{
+  return std::to_string(value);
+}
+
+static std::string support(KeyFrame::Support value)
+{
+  switch (value) {
+    case KeyFrame::Support::Double: return "KeyFrame::Support::Double";
+    case KeyFrame::Support::Left: return "KeyFrame::Support::Left";
+    case KeyFrame::Support::Right: return "KeyFrame::Support::Right";
+    default: return "KeyFrame::Support::None";
+  }
+}
+
+// Hexadecimal float literals are exact
+static std::string hexFloat(float value)
+{
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%af", value);
+  return buffer;
+}
+
+int main(int argc, char * argv[])
+{
+  if (argc < 2) {
+    std::cerr << "usage: nao_pos_embed <output.cpp> <file.pos>...\n";
+    return 1;
+  }
+
+  // Diagnostics are printed on failure, the parser log would only duplicate them
+  rcutils_logging_set_logger_level("parser", RCUTILS_LOG_SEVERITY_FATAL);
+
+  std::vector<std::string> names;
+  std::vector<std::shared_ptr<const motion::Motion>> motions;
+  auto pool = std::make_shared<motion::KeyFramePool>();
+  for (int i = 2; i < argc; ++i) {
+    std::ifstream file(argv[i]);
+    if (!file.is_open()) {
+      std::cerr << "nao_pos_embed: could not open " << argv[i] << "\n";
+      return 1;
+    }
+    auto lines = parser::readLines(file);
+    auto parseResult = parser::parse(lines);
+    if (!parseResult.successful) {
+      // Joint limit warnings alone are left to nao_pos_lint, the stock getups exceed some limits
+      for (const auto & diagnostic : parseResult.diagnostics) {
+        bool isError = diagnostic.severity == parser::Diagnostic::Severity::Error;
+        std::cerr << argv[i] << ":" << diagnostic.line << ": " << (isError ? "error" : "warning")
+                  << ": " << diagnostic.message << "\n";
+      }
+      return 1;
+    }
+    names.push_back(fs::path(argv[i]).stem().string());
+    motions.push_back(
+      motion::Motion::fromKeyFrames(
+        parseResult.keyFrames, std::pmr::get_default_resource(), pool));
+    auto contacts = collision::check(*motions.back());
+    collision::dropKnown(contacts, parseResult.knownContacts);
+    for (const auto & contact : contacts) {
+      std::cerr << argv[i] << ":0: warning: " << collision::describe(contact) << "\n";
+    }
+    for (const auto & segment : stability::analyze(*motions.back())) {
+      if (!segment.stable()) {
+        std::cerr << argv[i] << ":0: warning: " << stability::describe(segment) << "\n";
+      }
+    }
+  }
+
+  std::ofstream out(argv[1]);
+  out << "// Generated by nao_pos_embed, do not edit\n\n"
+      << "#include \"embedded_motions.hpp\"\n\n"
+      << "namespace motion\n{\nnamespace embedded\n{\n\nnamespace\n{\n";
+
+  // Distinct rows of the pool, each at its offset in the rows table
+  std::vector<float> rows;
+  std::unordered_map<const float *, std::size_t> rowOffsets;
+  auto rowOffset = [&rows, &rowOffsets](const float * row, std::size_t size) {
+      auto inserted = rowOffsets.emplace(row, rows.size());
+      if (inserted.second) {
+        rows.insert(rows.end(), row, row + size);
+      }
+      return inserted.first->second;
+    };
+  std::vector<std::vector<std::size_t>> positionOffsets(motions.size());
+  std::vector<std::vector<std::size_t>> stiffnessOffsets(motions.size());
+  for (std::size_t m = 0; m < motions.size(); ++m) {
+    for (std::size_t k = 0; k < motions[m]->numKeyFrames(); ++k) {
+      positionOffsets[m].push_back(rowOffset(motions[m]->positions(k), motions[m]->numJoints()));
+      stiffnessOffsets[m].push_back(
+        rowOffset(motions[m]->stiffnesses(k), motions[m]->numJoints()));
+    }
+  }
+  out << "\n// Keyframe rows of every motion, shared between motions\n";
+  writeArray(out, "float", "rows", rows.data(), rows.size(), hexFloat);
+  auto row = [](std::size_t offset) {return "rows + " + std::to_string(offset);};
+
+  for (std::size_t m = 0; m < motions.size(); ++m) {
+    const motion::Motion::Tables & tables = motions[m]->tables();
+    const std::string id = "motion" + std::to_string(m);
+
+    out << "\n// " << names[m] << ".pos\n";
+    writeArray(out, "uint8_t", id + "_joints", tables.joints, tables.numJoints, integer);
+    writeArray(
+      out, "unsigned", id + "_times_ms", tables.times_ms, tables.numKeyFrames, integer);
+    writeArray(
+      out, "const float *", id + "_position_rows", positionOffsets[m].data(),
+      tables.numKeyFrames, row);
+    writeArray(
+      out, "const float *", id + "_stiffness_rows", stiffnessOffsets[m].data(),
+      tables.numKeyFrames, row);
+    writeArray(out, "uint8_t", id + "_holds", tables.holds, tables.numKeyFrames, integer);
+    writeArray(
+      out, "KeyFrame::Support", id + "_supports", tables.supports, tables.numKeyFrames, support);
+    out << "const Motion " << id << "{Motion::Tables{\n  "
+        << id << "_joints, " << tables.numJoints << ", "
+        << id << "_times_ms, " << tables.numKeyFrames << ",\n  "
+        << id << "_position_rows, " << id << "_stiffness_rows, " << id << "_holds, "
+        << id << "_supports}};\n";
+  }
+
+  out << "\n}  // namespace\n\nconst EmbeddedMotion motions[] = {\n";
+  for (std::size_t m = 0; m < motions.size(); ++m) {
+    out << "  {\"" << names[m] << "\", &motion" << m << "},\n";
+  }
+  out << "  {nullptr, nullptr}};\n\n}  // namespace embedded\n}  // namespace motion\n";
+
+  return out.good() ? 0 : 1;
+}
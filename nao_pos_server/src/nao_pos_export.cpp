@@ -0,0 +1,208 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Renders a pos file into a trajectory sampled at a fixed rate, using the same evaluation as
+// the action server:
+//
+//   nao_pos_export <file.pos> [--rate HZ] [--format csv|bin] [--start first|zero]
+//                  [--engine float|fixed] [--output PATH]
+//
+// csv: a header line, then one line per sample: t_ms, positions (rad), stiffnesses.
+// bin: the same rows as raw native float32, without header. The column layout is printed on
+//      stderr.
+// With --engine fixed the samples are taken at integer microseconds and evaluated by the
+// integer-only FixedMotion, so the output is bit-identical on every machine (golden traces).
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "indexes.hpp"
+#include "nao_pos_server/fixed_motion.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "parser.hpp"
+#include "rcutils/logging.h"
+
+// Timestamps evaluated per batch, bounds the memory used for long motions at high rates
+static constexpr std::size_t BATCH_SIZE = 4096;
+
+static void usage()
+{
+  std::cerr <<
+    "usage: nao_pos_export <file.pos> [--rate HZ] [--format csv|bin] [--start first|zero] "
+    "[--engine float|fixed] [--output PATH]\n"
+    "  --rate    sampling rate, default 1000\n"
+    "  --format  csv (default) or bin, raw native float32 rows\n"
+    "  --start   pose the motion starts from: first keyframe (default) or all zeros\n"
+    "  --engine  float (default, same as the action server) or fixed, integer-only evaluation\n"
+    "  --output  output file, default stdout\n";
+}
+
+int main(int argc, char * argv[])
+{
+  std::string input;
+  double rate = 1000.0;
+  std::string format = "csv";
+  std::string start = "first";
+  std::string engine = "float";
+  std::string output;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--rate" && hasValue) {
+      rate = std::stod(argv[++i]);
+    } else if (arg == "--format" && hasValue) {
+      format = argv[++i];
+    } else if (arg == "--start" && hasValue) {
+      start = argv[++i];
+    } else if (arg == "--engine" && hasValue) {
+      engine = argv[++i];
+    } else if (arg == "--output" && hasValue) {
+      output = argv[++i];
+    } else if (input.empty() && arg.compare(0, 2, "--") != 0) {
+      input = arg;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (input.empty() || rate <= 0 || (format != "csv" && format != "bin") ||
+    (start != "first" && start != "zero") || (engine != "float" && engine != "fixed"))
+  {
+    usage();
+    return 1;
+  }
+
+  // Diagnostics are printed on stderr, the parser log would only duplicate them
+  rcutils_logging_set_logger_level("parser", RCUTILS_LOG_SEVERITY_FATAL);
+
+  // Parsed here rather than through a MotionStore, which would serve the embedded motion of the
+  // same name instead of the file
+  std::ifstream ifstream(input);
+  if (!ifstream.is_open()) {
+    std::cerr << input << ":0: error: could not open file\n";
+    return 1;
+  }
+  auto lines = parser::readLines(ifstream);
+  auto parseResult = parser::parse(lines);
+  if (!parseResult.successful) {
+    for (const auto & diagnostic : parseResult.diagnostics) {
+      bool isError = diagnostic.severity == parser::Diagnostic::Severity::Error;
+      std::cerr << input << ":" << diagnostic.line << ": " << (isError ? "error" : "warning")
+                << ": " << diagnostic.message << "\n";
+    }
+    return 1;
+  }
+  auto motion = motion::Motion::fromKeyFrames(parseResult.keyFrames);
+
+  const std::size_t numJoints = motion->numJoints();
+  std::vector<float> startPose(numJoints, 0.0f);
+  if (start == "first" && motion->numKeyFrames() > 0) {
+    std::copy_n(motion->positions(0), numJoints, startPose.begin());
+  }
+
+  std::ofstream file;
+  if (!output.empty()) {
+    file.open(output, format == "bin" ? std::ios::binary : std::ios::out);
+    if (!file.is_open()) {
+      std::cerr << "could not open " << output << "\n";
+      return 1;
+    }
+  }
+  std::ostream & out = output.empty() ? std::cout : file;
+
+  std::string header = "t_ms";
+  for (auto joint : motion->joints()) {
+    header += "," + indexes::names.at(joint);
+  }
+  for (auto joint : motion->joints()) {
+    header += "," + indexes::names.at(joint) + "_stiffness";
+  }
+  if (format == "csv") {
+    // Enough digits to read back the exact float values
+    out << std::setprecision(std::numeric_limits<float>::max_digits10);
+    out << header << "\n";
+  } else {
+    std::cerr << "float32 columns: " << header << "\n";
+  }
+
+  const double period_ms = 1000.0 / rate;
+  const std::size_t numSamples =
+    motion->numKeyFrames() > 0 ? static_cast<std::size_t>(motion->durationMs() / period_ms) + 1 : 0;
+
+  std::vector<float> times(BATCH_SIZE);
+  std::vector<float> positions(BATCH_SIZE * numJoints);
+  std::vector<float> stiffnesses(BATCH_SIZE * numJoints);
+  std::vector<float> row(1 + 2 * numJoints);
+
+  std::shared_ptr<const motion::FixedMotion> fixed;
+  std::vector<int32_t> fixedStartPose(numJoints);
+  std::vector<int32_t> fixedPositions(numJoints);
+  std::vector<int32_t> fixedStiffnesses(numJoints);
+  const int64_t period_us = std::llround(1e6 / rate);
+  if (engine == "fixed") {
+    fixed = motion::FixedMotion::fromMotion(*motion);
+    std::transform(
+      startPose.begin(), startPose.end(), fixedStartPose.begin(), motion::FixedMotion::toFixed);
+  }
+
+  for (std::size_t first = 0; first < numSamples; first += BATCH_SIZE) {
+    const std::size_t count = std::min(BATCH_SIZE, numSamples - first);
+    if (fixed) {
+      for (std::size_t i = 0; i < count; ++i) {
+        const int64_t time_us = static_cast<int64_t>(first + i) * period_us;
+        times[i] = time_us / 1000.0f;
+        fixed->evaluate(
+          time_us, fixedStartPose.data(), fixedPositions.data(), fixedStiffnesses.data());
+        std::transform(
+          fixedPositions.begin(), fixedPositions.end(), &positions[i * numJoints],
+          motion::FixedMotion::toFloat);
+        std::transform(
+          fixedStiffnesses.begin(), fixedStiffnesses.end(), &stiffnesses[i * numJoints],
+          motion::FixedMotion::toFloat);
+      }
+    } else {
+      for (std::size_t i = 0; i < count; ++i) {
+        times[i] = (first + i) * period_ms;
+      }
+      motion->evaluateBatch(
+        times.data(), count, startPose.data(), positions.data(), stiffnesses.data());
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+      row[0] = times[i];
+      std::copy_n(&positions[i * numJoints], numJoints, row.begin() + 1);
+      std::copy_n(&stiffnesses[i * numJoints], numJoints, row.begin() + 1 + numJoints);
+      if (format == "csv") {
+        for (std::size_t c = 0; c < row.size(); ++c) {
+          out << (c == 0 ? "" : ",") << row[c];
+        }
+        out << "\n";
+      } else {
+        out.write(reinterpret_cast<const char *>(row.data()), row.size() * sizeof(float));
+      }
+    }
+  }
+
+  return out.good() ? 0 : 1;
+}
@@ -0,0 +1,318 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nao_pos_server/nao_pos_fleet_server.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+#include "rclcpp/rclcpp.hpp"
+#include "rclcpp/strategies/message_pool_memory_strategy.hpp"
+
+namespace nao_pos_fleet_server_ns
+{
+
+static constexpr std::size_t NUMJOINTS = nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS;
+
+// Samples are delivered one at a time and copied out, one preallocated message per robot serves
+// every delivery
+using SensorMessagePool =
+  rclcpp::strategies::message_pool_memory_strategy::MessagePoolMemoryStrategy<
+  nao_lola_sensor_msgs::msg::JointPositions, 1>;
+
+static std::string topicName(const std::string & ns, const std::string & name)
+{
+  return ns.empty() ? "/" + name : "/" + ns + "/" + name;
+}
+
+NaoPosFleetServer::NaoPosFleetServer(const rclcpp::NodeOptions & options)
+: rclcpp::Node{"nao_pos_fleet_server_node", options}
+{
+  motion_store_ = std::make_shared<motion::MotionStore>();
+
+  auto param_desc = rcl_interfaces::msg::ParameterDescriptor{};
+  param_desc.description = "Namespaces of the robots hosted by this fleet server";
+  auto robot_namespaces = this->declare_parameter<std::vector<std::string>>(
+    "robot_namespaces", std::vector<std::string>{}, param_desc);
+  param_desc.description = "Period of the playback tick, 12 ms matches the LoLA cycle";
+  auto tick_period_ms = this->declare_parameter<int>("tick_period_ms", 12, param_desc);
+  param_desc.description =
+    "A robot whose command is published later than this after the previous one counts as a "
+    "deadline miss in its execution report";
+  tick_deadline_ms_ = this->declare_parameter<double>("tick_deadline_ms", 18.0, param_desc);
+  param_desc.description =
+    "Evaluate playbacks with the integer-only engine: bit-identical commands on any machine";
+  fixed_point_ = this->declare_parameter<bool>("fixed_point", false, param_desc);
+  param_desc.description =
+    "Check the motions loaded from pos files for arm self collisions and log the contacts";
+  motion_store_->setSelfCollisionCheck(
+    this->declare_parameter<bool>("check_self_collision", false, param_desc));
+  param_desc.description =
+    "Check the static stability of the motions loaded from pos files and log unstable segments";
+  motion_store_->setStabilityCheck(
+    this->declare_parameter<bool>("check_stability", false, param_desc));
+
+  if (robot_namespaces.empty()) {
+    RCLCPP_WARN(this->get_logger(), "robot_namespaces is empty, no robot will be served");
+  }
+  for (const auto & ns : robot_namespaces) {
+    addRobot(ns);
+  }
+
+  // Follows the node clock, so the fleet runs at simulation speed when use_sim_time is set
+  timer_ = rclcpp::create_timer(
+    this, this->get_clock(), std::chrono::milliseconds(tick_period_ms),
+    std::bind(&NaoPosFleetServer::tick, this));
+
+  RCLCPP_INFO(
+    this->get_logger(), "nao_pos_fleet_server_node initialized with %zu robots", robots_.size());
+}
+
+NaoPosFleetServer::~NaoPosFleetServer() {}
+
+void NaoPosFleetServer::addRobot(const std::string & ns)
+{
+  const std::size_t r = robots_.size();
+  robots_.emplace_back();
+  Robot & robot = robots_.back();
+  robot.ns = ns;
+
+  robot.pub_joint_positions = create_publisher<nao_lola_command_msgs::msg::JointPositions>(
+    topicName(ns, "effectors/joint_positions"), rclcpp::SensorDataQoS());
+  robot.pub_joint_stiffnesses = create_publisher<nao_lola_command_msgs::msg::JointStiffnesses>(
+    topicName(ns, "effectors/joint_stiffnesses"), rclcpp::SensorDataQoS());
+
+  // Only store the latest sample, playbacks are evaluated by the fleet tick
+  robot.sub_joint_states = create_subscription<nao_lola_sensor_msgs::msg::JointPositions>(
+    topicName(ns, "sensors/joint_positions"), rclcpp::SensorDataQoS(),
+    [this, r](nao_lola_sensor_msgs::msg::JointPositions::SharedPtr sensor_joints) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::copy(
+        sensor_joints->positions.begin(), sensor_joints->positions.end(),
+        sensor_positions_.begin() + r * NUMJOINTS);
+      sensed_[r] = true;
+    },
+    rclcpp::SubscriptionOptions(), std::make_shared<SensorMessagePool>());
+
+  robot.action_server = rclcpp_action::create_server<PosPlay>(
+    this, topicName(ns, "nao_pos_action"),
+    [this, r](const rclcpp_action::GoalUUID &, std::shared_ptr<const PosPlay::Goal> goal) {
+      return handleGoal(r, goal);
+    },
+    [this, r](const std::shared_ptr<GoalHandlePosPlay>) {return handleCancel(r);},
+    [this, r](const std::shared_ptr<GoalHandlePosPlay> goal_handle) {
+      handleAccepted(r, goal_handle);
+    });
+
+  motions_.emplace_back();
+  active_.push_back(false);
+  first_tick_.push_back(true);
+  sensed_.push_back(false);
+  initial_times_.emplace_back(0, 0, this->get_clock()->get_clock_type());
+  times_us_.push_back(0);
+  times_ms_.push_back(0.0f);
+  segments_.push_back(0);
+  betas_.push_back(0.0f);
+  stats_.emplace_back();
+  sensor_positions_.resize(robots_.size() * NUMJOINTS, 0.0f);
+  start_positions_.resize(robots_.size() * NUMJOINTS, 0.0f);
+  positions_.resize(robots_.size() * NUMJOINTS, 0.0f);
+  stiffnesses_.resize(robots_.size() * NUMJOINTS, 0.0f);
+  fixed_motions_.emplace_back();
+  fixed_start_positions_.resize(robots_.size() * NUMJOINTS, 0);
+  fixed_positions_.resize(robots_.size() * NUMJOINTS, 0);
+  fixed_stiffnesses_.resize(robots_.size() * NUMJOINTS, 0);
+}
+
+void NaoPosFleetServer::tick()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const auto tick_start = stats::ExecutionStats::Clock::now();
+  const rclcpp::Time now = this->now();
+  const std::size_t numRobots = robots_.size();
+
+  // Advance the timeline of every active playback
+  for (std::size_t r = 0; r < numRobots; ++r) {
+    if (!active_[r]) {
+      continue;
+    }
+    // Even before the first sensor sample of the robot
+    if (robots_[r].goal_handle->is_canceling()) {
+      finish(r, false);
+      continue;
+    }
+    if (!sensed_[r]) {
+      continue;
+    }
+
+    const int64_t elapsed_ns = (now - initial_times_[r]).nanoseconds();
+    times_ms_[r] = elapsed_ns / 1e6;
+    times_us_[r] = elapsed_ns / 1000;
+    if (times_ms_[r] < 0) {
+      // Armed, waiting for the requested start_time
+      continue;
+    }
+    const motion::Motion & motion = *motions_[r];
+    if (fixed_point_ ? fixed_motions_[r]->finished(times_us_[r]) : motion.finished(times_ms_[r])) {
+      finish(r, true);
+      continue;
+    }
+
+    if (first_tick_[r]) {
+      const auto & joints = motion.joints();
+      for (std::size_t j = 0; j < joints.size(); ++j) {
+        start_positions_[r * NUMJOINTS + j] = sensor_positions_[r * NUMJOINTS + joints[j]];
+        fixed_start_positions_[r * NUMJOINTS + j] =
+          motion::FixedMotion::toFixed(start_positions_[r * NUMJOINTS + j]);
+      }
+      segments_[r] = 0;
+      first_tick_[r] = false;
+    } else {
+      // The command published at the previous tick against the pose sensed since
+      const Robot & robot = robots_[r];
+      stats_[r].recordTrackingError(
+        robot.effector_joints.indexes.data(), robot.effector_joints.indexes.size(),
+        robot.effector_joints.positions.data(), &sensor_positions_[r * NUMJOINTS]);
+    }
+
+    if (fixed_point_) {
+      segments_[r] = fixed_motions_[r]->segmentFrom(segments_[r], times_us_[r]);
+    } else {
+      segments_[r] = motion.segmentFrom(segments_[r], times_ms_[r]);
+      betas_[r] = motion.beta(segments_[r], times_ms_[r]);
+    }
+  }
+
+  // Interpolate all robots into the contiguous output rows
+  for (std::size_t r = 0; r < numRobots; ++r) {
+    if (!active_[r] || first_tick_[r] || times_ms_[r] < 0) {
+      continue;
+    }
+    if (fixed_point_) {
+      fixed_motions_[r]->interpolate(
+        segments_[r], times_us_[r], &fixed_start_positions_[r * NUMJOINTS],
+        &fixed_positions_[r * NUMJOINTS], &fixed_stiffnesses_[r * NUMJOINTS]);
+      const std::size_t numJoints = motions_[r]->numJoints();
+      for (std::size_t j = r * NUMJOINTS; j < r * NUMJOINTS + numJoints; ++j) {
+        positions_[j] = motion::FixedMotion::toFloat(fixed_positions_[j]);
+        stiffnesses_[j] = motion::FixedMotion::toFloat(fixed_stiffnesses_[j]);
+      }
+    } else {
+      motions_[r]->interpolate(
+        segments_[r], betas_[r], &start_positions_[r * NUMJOINTS], &positions_[r * NUMJOINTS],
+        &stiffnesses_[r * NUMJOINTS]);
+    }
+  }
+
+  for (std::size_t r = 0; r < numRobots; ++r) {
+    if (!active_[r] || first_tick_[r] || times_ms_[r] < 0) {
+      continue;
+    }
+    Robot & robot = robots_[r];
+    const std::size_t numJoints = motions_[r]->numJoints();
+    std::copy_n(&positions_[r * NUMJOINTS], numJoints, robot.effector_joints.positions.begin());
+    std::copy_n(
+      &stiffnesses_[r * NUMJOINTS], numJoints, robot.effector_joints_stiff.stiffnesses.begin());
+    robot.pub_joint_positions->publish(robot.effector_joints);
+    robot.pub_joint_stiffnesses->publish(robot.effector_joints_stiff);
+    // The latency of a robot runs from the start of the fleet tick to its command
+    stats_[r].recordTick(tick_start, stats::ExecutionStats::Clock::now());
+  }
+}
+
+void NaoPosFleetServer::finish(std::size_t r, bool success)
+{
+  auto result = std::make_shared<PosPlay::Result>();
+  result->success = success;
+  stats_[r].fillResult(*result);
+  if (success) {
+    robots_[r].goal_handle->succeed(result);
+  } else {
+    robots_[r].goal_handle->canceled(result);
+  }
+  robots_[r].goal_handle.reset();
+  motions_[r].reset();
+  fixed_motions_[r].reset();
+  active_[r] = false;
+  RCLCPP_DEBUG(
+    this->get_logger(), "[%s] pos %s", robots_[r].ns.c_str(), success ? "finished" : "canceled");
+}
+
+rclcpp_action::GoalResponse NaoPosFleetServer::handleGoal(
+  std::size_t r, std::shared_ptr<const PosPlay::Goal> goal)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  RCLCPP_INFO(
+    get_logger(), "[%s] Received goal request for:  %s", robots_[r].ns.c_str(),
+    goal->action_name.c_str());
+
+  rclcpp::Time start_time(goal->start_time, this->get_clock()->get_clock_type());
+  if (start_time.nanoseconds() != 0 && start_time < this->now()) {
+    RCLCPP_ERROR(get_logger(), "[%s] Requested start_time is in the past", robots_[r].ns.c_str());
+    return rclcpp_action::GoalResponse::REJECT;
+  }
+
+  if (!active_[r]) {
+    motions_[r] = motion_store_->load(goal->action_name);
+    if (motions_[r]) {
+      if (fixed_point_) {
+        fixed_motions_[r] = motion::FixedMotion::fromMotion(*motions_[r]);
+      }
+      return rclcpp_action::GoalResponse::ACCEPT_AND_EXECUTE;
+    }
+  }
+
+  return rclcpp_action::GoalResponse::REJECT;
+}
+
+rclcpp_action::CancelResponse NaoPosFleetServer::handleCancel(std::size_t r)
+{
+  RCLCPP_INFO(get_logger(), "[%s] Received request to cancel goal", robots_[r].ns.c_str());
+  // The goal is moved to canceled by the next tick
+  return rclcpp_action::CancelResponse::ACCEPT;
+}
+
+void NaoPosFleetServer::handleAccepted(
+  std::size_t r, const std::shared_ptr<GoalHandlePosPlay> goal_handle)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  RCLCPP_INFO(this->get_logger(), "[%s] Starting Pos Action", robots_[r].ns.c_str());
+
+  Robot & robot = robots_[r];
+  const auto & joints = motions_[r]->joints();
+  robot.effector_joints.indexes.assign(joints.begin(), joints.end());
+  robot.effector_joints.positions.assign(joints.size(), 0.0f);
+  robot.effector_joints_stiff.indexes.assign(joints.begin(), joints.end());
+  robot.effector_joints_stiff.stiffnesses.assign(joints.size(), 0.0f);
+  robot.goal_handle = goal_handle;
+
+  rclcpp::Time start_time(goal_handle->get_goal()->start_time, this->get_clock()->get_clock_type());
+  initial_times_[r] = start_time.nanoseconds() != 0 ? start_time : this->now();
+  stats_[r].reset(
+    std::chrono::duration_cast<stats::ExecutionStats::Clock::duration>(
+      std::chrono::duration<double, std::milli>(tick_deadline_ms_)));
+  first_tick_[r] = true;
+  active_[r] = true;
+}
+
+}  // namespace nao_pos_fleet_server_ns
+
+#include "rclcpp_components/register_node_macro.hpp"
+RCLCPP_COMPONENTS_REGISTER_NODE(nao_pos_fleet_server_ns::NaoPosFleetServer)
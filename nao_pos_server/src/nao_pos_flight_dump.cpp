@@ -0,0 +1,137 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Converts a flight recorder file (see flight_recorder.hpp) to CSV:
+//
+//   nao_pos_flight_dump <file.rec> [--seconds S] [--output PATH]
+//
+// A header line, then one line per record, oldest first: stamp_ns (node clock), kind (sensor,
+// command, stiffness, goal or cancel), the goal name for goal records, then one column per
+// joint, empty for the joints a record does not carry. The file can be read while the server
+// keeps recording.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "indexes.hpp"
+#include "nao_pos_server/flight_recorder.hpp"
+
+static void usage()
+{
+  std::cerr <<
+    "usage: nao_pos_flight_dump <file.rec> [--seconds S] [--output PATH]\n"
+    "  --seconds  only the records of the last S seconds before the newest one\n"
+    "  --output   output file, default stdout\n";
+}
+
+static const char * kindName(recorder::Kind kind)
+{
+  switch (kind) {
+    case recorder::Kind::SensorPositions: return "sensor";
+    case recorder::Kind::CommandPositions: return "command";
+    case recorder::Kind::CommandStiffnesses: return "stiffness";
+    case recorder::Kind::GoalAccepted: return "goal";
+    case recorder::Kind::GoalCanceled: return "cancel";
+    default: return "unknown";
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  std::string input;
+  double seconds = 0.0;
+  std::string output;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--seconds" && hasValue) {
+      seconds = std::stod(argv[++i]);
+    } else if (arg == "--output" && hasValue) {
+      output = argv[++i];
+    } else if (input.empty() && arg.compare(0, 2, "--") != 0) {
+      input = arg;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (input.empty() || seconds < 0) {
+    usage();
+    return 1;
+  }
+
+  auto samples = recorder::FlightRecorder::readFile(input);
+  if (!samples) {
+    std::cerr << input << " is not a flight recorder file\n";
+    return 1;
+  }
+
+  auto first = samples->begin();
+  if (seconds > 0 && !samples->empty()) {
+    const int64_t from_ns = samples->back().stamp_ns - static_cast<int64_t>(seconds * 1e9);
+    first = std::find_if(
+      samples->begin(), samples->end(),
+      [from_ns](const recorder::Sample & sample) {return sample.stamp_ns >= from_ns;});
+  }
+
+  std::ofstream file;
+  if (!output.empty()) {
+    file.open(output);
+    if (!file.is_open()) {
+      std::cerr << "could not open " << output << "\n";
+      return 1;
+    }
+  }
+  std::ostream & out = output.empty() ? std::cout : file;
+
+  // Enough digits to read back the exact float values
+  out << std::setprecision(std::numeric_limits<float>::max_digits10);
+  out << "stamp_ns,kind,goal";
+  for (const auto & name : indexes::names) {
+    out << "," << name;
+  }
+  out << "\n";
+
+  // Joint values by joint index, NaN for the joints missing from the record
+  std::vector<float> row(indexes::names.size());
+  for (auto it = first; it != samples->end(); ++it) {
+    std::fill(row.begin(), row.end(), std::numeric_limits<float>::quiet_NaN());
+    const bool goal =
+      it->kind == recorder::Kind::GoalAccepted || it->kind == recorder::Kind::GoalCanceled;
+    for (std::size_t j = 0; !goal && j < it->numJoints; ++j) {
+      if (it->joints[j] < row.size()) {
+        row[it->joints[j]] = it->values[j];
+      }
+    }
+    out << it->stamp_ns << "," << kindName(it->kind) << "," << (goal ? it->goalName() : "");
+    for (float value : row) {
+      out << ",";
+      if (!std::isnan(value)) {
+        out << value;
+      }
+    }
+    out << "\n";
+  }
+
+  return out.good() ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nao_pos_server/nao_pos_latency_bench.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nao_pos_latency_bench_ns
+{
+
+NaoPosLatencyBench::NaoPosLatencyBench(const rclcpp::NodeOptions & options)
+: rclcpp::Node{"nao_pos_latency_bench_node", options}
+{
+  using namespace std::placeholders;
+
+  auto param_desc = rcl_interfaces::msg::ParameterDescriptor{};
+  param_desc.description = "pos file played during the benchmark";
+  pos_file_ = this->declare_parameter<std::string>("pos_file", "move_head", param_desc);
+  param_desc.description = "Number of times the pos file is played";
+  goals_left_ = this->declare_parameter<int>("goals", 5, param_desc);
+  param_desc.description = "Rate of the simulated sensor samples";
+  double rate_hz = this->declare_parameter<double>("rate_hz", 83.0, param_desc);
+  param_desc.description = "Number of busy threads competing for the CPU during the benchmark";
+  int contention_threads = this->declare_parameter<int>("contention_threads", 0, param_desc);
+
+  for (int i = 0; i < contention_threads; ++i) {
+    contention_threads_.emplace_back(
+      [this]() {
+        volatile uint64_t spin = 0;
+        while (contention_running_) {
+          spin = spin + 1;
+        }
+      });
+  }
+
+  latencies_ns_.reserve(10000);
+
+  pub_sensor_ = create_publisher<nao_lola_sensor_msgs::msg::JointPositions>(
+    "/sensors/joint_positions", rclcpp::SensorDataQoS());
+  sub_command_ = create_subscription<nao_lola_command_msgs::msg::JointPositions>(
+    "/effectors/joint_positions", rclcpp::SensorDataQoS(),
+    [this](nao_lola_command_msgs::msg::JointPositions::SharedPtr command) {
+      onCommand(*command);
+    });
+  client_ = rclcpp_action::create_client<PosPlay>(this, "nao_pos_action");
+
+  auto period = std::chrono::duration<double>(1.0 / rate_hz);
+  sensor_timer_ = create_wall_timer(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(period),
+    std::bind(&NaoPosLatencyBench::publishSensorSample, this));
+
+  // Poll for the server without blocking the executor
+  start_timer_ = create_wall_timer(
+    std::chrono::milliseconds(500), [this]() {
+      if (client_->action_server_is_ready()) {
+        start_timer_->cancel();
+        sendGoal();
+      }
+    });
+
+  RCLCPP_INFO(this->get_logger(), "nao_pos_latency_bench_node initialized");
+}
+
+NaoPosLatencyBench::~NaoPosLatencyBench()
+{
+  contention_running_ = false;
+  for (auto & thread : contention_threads_) {
+    thread.join();
+  }
+}
+
+int64_t NaoPosLatencyBench::nowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    Clock::now().time_since_epoch()).count();
+}
+
+void NaoPosLatencyBench::publishSensorSample()
+{
+  last_sample_ns_ = nowNs();
+  ++sample_seq_;
+  pub_sensor_->publish(sensor_sample_);
+}
+
+void NaoPosLatencyBench::onCommand(const nao_lola_command_msgs::msg::JointPositions &)
+{
+  int64_t now_ns = nowNs();
+
+  if (waiting_first_command_.exchange(false)) {
+    goal_first_command_latencies_ns_.push_back(now_ns - goal_sent_ns_);
+  }
+
+  // Only the first command answering a sample counts
+  uint64_t seq = sample_seq_;
+  if (seq == answered_seq_) {
+    return;
+  }
+  answered_seq_ = seq;
+  latencies_ns_.push_back(now_ns - last_sample_ns_);
+}
+
+void NaoPosLatencyBench::sendGoal()
+{
+  auto goal = PosPlay::Goal();
+  goal.action_name = pos_file_;
+
+  auto send_goal_options = rclcpp_action::Client<PosPlay>::SendGoalOptions();
+  send_goal_options.goal_response_callback = std::bind(
+    &NaoPosLatencyBench::onGoalResponse, this, std::placeholders::_1);
+  send_goal_options.result_callback = std::bind(
+    &NaoPosLatencyBench::onResult, this, std::placeholders::_1);
+  goal_sent_ns_ = nowNs();
+  waiting_first_command_ = true;
+  client_->async_send_goal(goal, send_goal_options);
+  --goals_left_;
+}
+
+void NaoPosLatencyBench::onGoalResponse(
+  const rclcpp_action::ClientGoalHandle<PosPlay>::SharedPtr & goal_handle)
+{
+  if (!goal_handle) {
+    // No result will follow: stop instead of waiting for it forever
+    RCLCPP_ERROR(
+      this->get_logger(), "goal rejected, is %s.pos available? Stopping the benchmark",
+      pos_file_.c_str());
+    waiting_first_command_ = false;
+    sensor_timer_->cancel();
+    rclcpp::shutdown();
+    return;
+  }
+  goal_accept_latencies_ns_.push_back(nowNs() - goal_sent_ns_);
+}
+
+void NaoPosLatencyBench::onResult(
+  const rclcpp_action::ClientGoalHandle<PosPlay>::WrappedResult & result)
+{
+  const auto & r = *result.result;
+  RCLCPP_INFO(
+    this->get_logger(), "server report: %u ticks at %.1f Hz, tick latency max %.0f us p99 %.0f us",
+    r.ticks, r.command_rate_hz, r.max_tick_latency_us, r.p99_tick_latency_us);
+
+  if (goals_left_ > 0) {
+    sendGoal();
+  } else {
+    sensor_timer_->cancel();
+    report();
+  }
+}
+
+void NaoPosLatencyBench::report()
+{
+  if (latencies_ns_.empty()) {
+    RCLCPP_ERROR(this->get_logger(), "no command received");
+    return;
+  }
+
+  logDistribution("sensor-to-command", latencies_ns_);
+  logDistribution("goal-to-accept", goal_accept_latencies_ns_);
+  logDistribution("goal-to-first-command", goal_first_command_latencies_ns_);
+}
+
+void NaoPosLatencyBench::logDistribution(
+  const char * name, const std::vector<int64_t> & latencies_ns)
+{
+  if (latencies_ns.empty()) {
+    return;
+  }
+
+  std::vector<int64_t> sorted = latencies_ns;
+  std::sort(sorted.begin(), sorted.end());
+  auto percentile_us = [&sorted](double p) {
+      return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))] / 1e3;
+    };
+  double mean_us =
+    std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size() / 1e3;
+
+  RCLCPP_INFO(
+    this->get_logger(),
+    "%s latency over %zu samples: mean %.0f us, p50 %.0f us, p90 %.0f us, "
+    "p99 %.0f us, max %.0f us",
+    name, sorted.size(), mean_us, percentile_us(0.5), percentile_us(0.9), percentile_us(0.99),
+    sorted.back() / 1e3);
+}
+
+}  // namespace nao_pos_latency_bench_ns
+
+#include "rclcpp_components/register_node_macro.hpp"
+RCLCPP_COMPONENTS_REGISTER_NODE(nao_pos_latency_bench_ns::NaoPosLatencyBench)
@@ -0,0 +1,166 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Validates pos files with the parser used by the action server, in parallel:
+//
+//   nao_pos_lint [--werror] [--collisions] [--stability] <file.pos | directory>...
+//
+// Directories are searched recursively for .pos files. Diagnostics are printed on stdout, one
+// per line, as "<file>:<line>: <error|warning>: <message>". The exit code is 1 if any file has
+// an error (or a warning with --werror).
+// With --collisions the files that parse also go through the self collision precheck, each
+// contact the file does not declare with '@ contact <arm> <body>' is a warning reported on line 0
+// with its times. With --stability, so does every segment declared in single or double support
+// whose center of mass leaves the support polygon, or that is shorter than the shortest duration
+// keeping it stable.
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "nao_pos_server/self_collision.hpp"
+#include "nao_pos_server/stability.hpp"
+#include "parser.hpp"
+#include "rcutils/logging.h"
+
+namespace fs = boost::filesystem;
+
+struct LintResult
+{
+  bool opened = false;
+  std::vector<parser::Diagnostic> diagnostics;
+  std::vector<collision::Contact> contacts;
+  std::vector<stability::Segment> unstable;
+};
+
+static LintResult lint(const std::string & path, bool collisions, bool stability)
+{
+  LintResult result;
+  std::ifstream ifstream(path);
+  if (!ifstream.is_open()) {
+    return result;
+  }
+  result.opened = true;
+  auto lines = parser::readLines(ifstream);
+  auto parseResult = parser::parse(lines);
+  result.diagnostics = std::move(parseResult.diagnostics);
+  if (!parseResult.successful || !(collisions || stability)) {
+    return result;
+  }
+  auto motion = motion::Motion::fromKeyFrames(parseResult.keyFrames);
+  if (collisions) {
+    result.contacts = collision::check(*motion);
+    collision::dropKnown(result.contacts, parseResult.knownContacts);
+  }
+  if (stability) {
+    for (const auto & segment : stability::analyze(*motion)) {
+      if (!segment.stable()) {
+        result.unstable.push_back(segment);
+      }
+    }
+  }
+  return result;
+}
+
+int main(int argc, char * argv[])
+{
+  bool werror = false;
+  bool collisions = false;
+  bool stability = false;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--werror") {
+      werror = true;
+    } else if (arg == "--collisions") {
+      collisions = true;
+    } else if (arg == "--stability") {
+      stability = true;
+    } else if (fs::is_directory(arg)) {
+      std::vector<std::string> found;
+      for (const auto & entry : fs::recursive_directory_iterator(arg)) {
+        if (fs::is_regular_file(entry.path()) && entry.path().extension() == ".pos") {
+          found.push_back(entry.path().string());
+        }
+      }
+      std::sort(found.begin(), found.end());
+      files.insert(files.end(), found.begin(), found.end());
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  if (files.empty()) {
+    std::cerr << "usage: nao_pos_lint [--werror] [--collisions] [--stability] "
+      "<file.pos | directory>...\n";
+    return 1;
+  }
+
+  // Diagnostics are reported on stdout, the parser log would only duplicate them
+  rcutils_logging_set_logger_level("parser", RCUTILS_LOG_SEVERITY_FATAL);
+
+  std::vector<LintResult> results(files.size());
+  std::atomic<std::size_t> next{0};
+  auto worker = [&]() {
+      for (std::size_t i = next++; i < files.size(); i = next++) {
+        results[i] = lint(files[i], collisions, stability);
+      }
+    };
+
+  std::size_t numThreads = std::min<std::size_t>(
+    std::max(1u, std::thread::hardware_concurrency()), files.size());
+  std::vector<std::thread> threads;
+  for (std::size_t t = 1; t < numThreads; ++t) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto & thread : threads) {
+    thread.join();
+  }
+
+  unsigned errors = 0;
+  unsigned warnings = 0;
+  for (std::size_t i = 0; i < files.size(); ++i) {
+    if (!results[i].opened) {
+      std::cout << files[i] << ":0: error: could not open file\n";
+      ++errors;
+      continue;
+    }
+    for (const auto & diagnostic : results[i].diagnostics) {
+      bool isError = diagnostic.severity == parser::Diagnostic::Severity::Error;
+      std::cout << files[i] << ":" << diagnostic.line << ": " << (isError ? "error" : "warning")
+                << ": " << diagnostic.message << "\n";
+      ++(isError ? errors : warnings);
+    }
+    for (const auto & contact : results[i].contacts) {
+      std::cout << files[i] << ":0: warning: " << collision::describe(contact) << "\n";
+      ++warnings;
+    }
+    for (const auto & segment : results[i].unstable) {
+      std::cout << files[i] << ":0: warning: " << stability::describe(segment) << "\n";
+      ++warnings;
+    }
+  }
+
+  std::cerr << files.size() << " files, " << errors << " errors, " << warnings << " warnings\n";
+  return errors > 0 || (werror && warnings > 0) ? 1 : 0;
+}
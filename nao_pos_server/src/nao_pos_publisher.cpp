@@ -1,47 +1,53 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "nao_pos_server/nao_pos_publisher.hpp"
+
 #include <chrono>
 #include <functional>
 #include <memory>
 #include <string>
 
-#include "rclcpp/rclcpp.hpp"
-#include "std_msgs/msg/string.hpp"
-
 using namespace std::chrono_literals;
 
-/* This example creates a subclass of Node and uses std::bind() to register a
- * member function as a callback from the timer. */
+namespace nao_pos_publisher_ns
+{
 
-class NaoPosPublisher : public rclcpp::Node
+NaoPosPublisher::NaoPosPublisher(const rclcpp::NodeOptions & options)
+: Node("nao_pos_publisher", options)
 {
-public:
-  NaoPosPublisher() : Node("nao_pos_publisher")
-  {
-    auto param_desc = rcl_interfaces::msg::ParameterDescriptor{};
-    param_desc.description = "This parameter sets the desired pos file to execute";
-    this->declare_parameter("pos_file", "only_legs", param_desc);
-
-    publisher_ = this->create_publisher<std_msgs::msg::String>("action_req", 10);
-    timer_ = this->create_wall_timer(10000ms, std::bind(&NaoPosPublisher::timer_callback, this));
-  }
-
-private:
-  void timer_callback()
-  {
-    std::string file_name = this->get_parameter("pos_file").as_string();
-    auto message = std_msgs::msg::String();
-    message.data = file_name;
-    RCLCPP_INFO(this->get_logger(), "Publishing: '%s'", message.data.c_str());
-    publisher_->publish(message);
-  }
-
-  rclcpp::TimerBase::SharedPtr timer_;
-  rclcpp::Publisher<std_msgs::msg::String>::SharedPtr publisher_;
-};
-
-int main(int argc, char * argv[])
+  auto param_desc = rcl_interfaces::msg::ParameterDescriptor{};
+  param_desc.description = "This parameter sets the desired pos file to execute";
+  this->declare_parameter("pos_file", "only_legs", param_desc);
+
+  publisher_ = this->create_publisher<std_msgs::msg::String>("action_req", 10);
+  timer_ = this->create_wall_timer(10000ms, std::bind(&NaoPosPublisher::timer_callback, this));
+}
+
+NaoPosPublisher::~NaoPosPublisher() {}
+
+void NaoPosPublisher::timer_callback()
 {
-  rclcpp::init(argc, argv);
-  rclcpp::spin(std::make_shared<NaoPosPublisher>());
-  rclcpp::shutdown();
-  return 0;
-}
\ No newline at end of file
+  std::string file_name = this->get_parameter("pos_file").as_string();
+  auto message = std_msgs::msg::String();
+  message.data = file_name;
+  RCLCPP_INFO(this->get_logger(), "Publishing: '%s'", message.data.c_str());
+  publisher_->publish(message);
+}
+
+}  // namespace nao_pos_publisher_ns
+
+#include "rclcpp_components/register_node_macro.hpp"
+RCLCPP_COMPONENTS_REGISTER_NODE(nao_pos_publisher_ns::NaoPosPublisher)
@@ -0,0 +1,237 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Replays a flight recorder file (see flight_recorder.hpp) through a NaoPosActionServer running
+// in this process, on a simulated clock, as fast as it can:
+//
+//   nao_pos_replay <file.rec> [--output PATH] [--ros-args ...]
+//
+// The ROS arguments go to the server, e.g. the --params-file of the recording robot, since the
+// commands depend on its parameters. Its topics and action are moved under /nao_pos_replay, so a
+// replay never commands a robot on the network.
+// Replay starts at the first goal of the recording. Before each record the node clock is set to
+// the time of the record: sensor samples tick the server directly, goals and cancels go through
+// an action client. The server records the replay in the output file (default <file.rec>.replay),
+// and the commands it published are compared with the recorded ones, which they match exactly
+// unless the robot ran with lookahead.delivery_latency (replayed samples have no delivery
+// latency). Exit status 0 if they match, 2 if they don't.
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nao_pos_interfaces/action/pos_play.hpp"
+#include "nao_pos_server/flight_recorder.hpp"
+#include "nao_pos_server/nao_pos_action_server.hpp"
+#include "rcl/time.h"
+#include "rclcpp/rclcpp.hpp"
+#include "rclcpp_action/rclcpp_action.hpp"
+
+using PosPlay = nao_pos_interfaces::action::PosPlay;
+using Clock = std::chrono::steady_clock;
+
+static constexpr auto RESPONSE_TIMEOUT = std::chrono::seconds(5);
+static const std::string NAMESPACE = "/nao_pos_replay";
+
+static void usage()
+{
+  std::cerr <<
+    "usage: nao_pos_replay <file.rec> [--output PATH] [--ros-args ...]\n"
+    "  --output    recorder file of the replay, default <file.rec>.replay\n"
+    "  --ros-args  arguments of the replayed server, e.g. --params-file robot.yaml\n";
+}
+
+static bool isCommand(const recorder::Sample & sample)
+{
+  return sample.kind == recorder::Kind::CommandPositions ||
+         sample.kind == recorder::Kind::CommandStiffnesses;
+}
+
+static bool sameCommand(const recorder::Sample & a, const recorder::Sample & b)
+{
+  // Bit exact
+  return a.kind == b.kind && a.stamp_ns == b.stamp_ns && a.numJoints == b.numJoints &&
+         std::equal(a.joints, a.joints + a.numJoints, b.joints) &&
+         std::memcmp(a.values, b.values, a.numJoints * sizeof(float)) == 0;
+}
+
+int main(int argc, char * argv[])
+{
+  std::string input;
+  std::string output;
+  std::vector<std::string> arguments = {
+    "--ros-args",
+    "-r", "/sensors/joint_positions:=" + NAMESPACE + "/sensors/joint_positions",
+    "-r", "/effectors/joint_positions:=" + NAMESPACE + "/effectors/joint_positions",
+    "-r", "/effectors/joint_stiffnesses:=" + NAMESPACE + "/effectors/joint_stiffnesses",
+    "-r", "nao_pos_action:=" + NAMESPACE + "/nao_pos_action"};
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--ros-args") {
+      arguments.insert(arguments.end(), argv + i + 1, argv + argc);
+      break;
+    } else if (arg == "--output" && hasValue) {
+      output = argv[++i];
+    } else if (input.empty() && arg.compare(0, 2, "--") != 0) {
+      input = arg;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (input.empty()) {
+    usage();
+    return 1;
+  }
+  if (output.empty()) {
+    output = input + ".replay";
+  }
+
+  auto recorded = recorder::FlightRecorder::readFile(input);
+  if (!recorded) {
+    std::cerr << input << " is not a flight recorder file\n";
+    return 1;
+  }
+  // Before the first goal the server was idle, or playing a goal whose start is lost
+  auto first = std::find_if(
+    recorded->begin(), recorded->end(),
+    [](const recorder::Sample & sample) {return sample.kind == recorder::Kind::GoalAccepted;});
+  if (first == recorded->end()) {
+    std::cerr << input << " holds no goal, nothing to replay\n";
+    return 1;
+  }
+
+  rclcpp::init(1, argv);
+
+  // An existing recorder file would be appended to
+  std::remove(output.c_str());
+  rclcpp::NodeOptions options;
+  options.use_global_arguments(false);
+  options.arguments(arguments);
+  options.parameter_overrides(
+    {
+      {"tick_mode", "executor"},
+      {"recorder.file", output},
+      {"recorder.capacity", static_cast<int64_t>(2 * recorded->size() + 16)},
+    });
+  auto server = std::make_shared<nao_pos_action_server_ns::NaoPosActionServer>(options);
+  auto client_node = std::make_shared<rclcpp::Node>(
+    "nao_pos_replay_client", NAMESPACE, rclcpp::NodeOptions().use_global_arguments(false));
+  auto client = rclcpp_action::create_client<PosPlay>(client_node, NAMESPACE + "/nao_pos_action");
+
+  rclcpp::executors::SingleThreadedExecutor executor;
+  executor.add_node(server);
+  executor.add_node(client_node);
+
+  // Simulated clock: it only moves when a record is replayed
+  rcl_clock_t * clock = server->get_clock()->get_clock_handle();
+  if (rcl_enable_ros_time_override(clock) != RCL_RET_OK) {
+    std::cerr << "the clock of the server can not be simulated\n";
+    rclcpp::shutdown();
+    return 1;
+  }
+  if (!client->wait_for_action_server(RESPONSE_TIMEOUT)) {
+    std::cerr << "the replayed action server is not available\n";
+    rclcpp::shutdown();
+    return 1;
+  }
+
+  std::size_t numSamples = 0;
+  std::size_t numGoals = 0;
+  std::size_t numRejected = 0;
+  Clock::duration tickTime{};
+  Clock::duration maxTickTime{};
+  rclcpp_action::ClientGoalHandle<PosPlay>::SharedPtr goal_handle;
+  nao_lola_sensor_msgs::msg::JointPositions sensor_joints;
+
+  for (auto it = first; it != recorded->end(); ++it) {
+    rcl_set_ros_time_override(clock, it->stamp_ns);
+    if (it->kind == recorder::Kind::SensorPositions) {
+      for (std::size_t j = 0; j < it->numJoints; ++j) {
+        if (it->joints[j] < sensor_joints.positions.size()) {
+          sensor_joints.positions[it->joints[j]] = it->values[j];
+        }
+      }
+      auto start = Clock::now();
+      server->processSample(sensor_joints);
+      auto elapsed = Clock::now() - start;
+      tickTime += elapsed;
+      maxTickTime = std::max(maxTickTime, elapsed);
+      ++numSamples;
+      // Goal results and feedback
+      executor.spin_some();
+    } else if (it->kind == recorder::Kind::GoalAccepted) {
+      PosPlay::Goal goal;
+      goal.action_name = it->goalName();
+      goal.start_time = rclcpp::Time(it->goalStartNs(), RCL_ROS_TIME);
+      auto future = client->async_send_goal(goal);
+      ++numGoals;
+      if (executor.spin_until_future_complete(future, RESPONSE_TIMEOUT) ==
+        rclcpp::FutureReturnCode::SUCCESS && future.get())
+      {
+        goal_handle = future.get();
+      } else {
+        std::cerr << "goal " << goal.action_name << " at " << it->stamp_ns << " ns was rejected\n";
+        ++numRejected;
+        goal_handle.reset();
+      }
+    } else if (it->kind == recorder::Kind::GoalCanceled && goal_handle) {
+      auto future = client->async_cancel_goal(goal_handle);
+      executor.spin_until_future_complete(future, RESPONSE_TIMEOUT);
+    }
+  }
+
+  std::vector<recorder::Sample> expected;
+  std::copy_if(first, recorded->end(), std::back_inserter(expected), isCommand);
+  std::vector<recorder::Sample> replayed;
+  auto replay = recorder::FlightRecorder::readFile(output);
+  if (replay) {
+    std::copy_if(replay->begin(), replay->end(), std::back_inserter(replayed), isCommand);
+  }
+
+  auto mismatch = std::mismatch(
+    expected.begin(), expected.end(), replayed.begin(), replayed.end(), sameCommand);
+  const bool identical = mismatch.first == expected.end() && mismatch.second == replayed.end();
+
+  using Microseconds = std::chrono::duration<double, std::micro>;
+  std::printf(
+    "replayed %zu samples and %zu goals (%zu rejected), tick %.1f us mean, %.1f us max\n",
+    numSamples, numGoals, numRejected,
+    numSamples == 0 ? 0.0 : Microseconds(tickTime).count() / numSamples,
+    Microseconds(maxTickTime).count());
+  std::printf("commands: %zu recorded, %zu replayed", expected.size(), replayed.size());
+  if (identical) {
+    std::printf(", identical\n");
+  } else {
+    const std::size_t index = mismatch.first - expected.begin();
+    const int64_t stamp_ns =
+      mismatch.first != expected.end() ? mismatch.first->stamp_ns : mismatch.second->stamp_ns;
+    std::printf(", first difference at command %zu (%" PRId64 " ns)\n", index, stamp_ns);
+  }
+  std::printf("replay recorded in %s\n", output.c_str());
+
+  server.reset();
+  rclcpp::shutdown();
+  return identical ? 0 : 2;
+}
@@ -14,13 +14,23 @@
 
 #include "parser.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <iterator>
+#include <memory_resource>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include "indexes.hpp"
+#include "joint_limits.hpp"
 #include "nao_lola_command_msgs/msg/joint_indexes.hpp"
 #include "rclcpp/logging.hpp"
 
@@ -54,144 +64,275 @@ std::string vec2str(const std::vector<uint8_t> & vec)
 
 static rclcpp::Logger logger = rclcpp::get_logger("parser");
 
-// Forward declaration
-std::vector<std::string> split(const std::string & line);
+// Splits line on whitespace. Tokens point into line, tokens keeps its capacity between calls.
+static void split(const std::string & line, std::pmr::vector<std::string_view> & tokens)
+{
+  tokens.clear();
+  const char * whitespace = " \t\r\n\v\f";
+  std::size_t begin = line.find_first_not_of(whitespace);
+  while (begin != std::string::npos) {
+    std::size_t end = line.find_first_of(whitespace, begin);
+    tokens.emplace_back(
+      line.data() + begin, (end == std::string::npos ? line.size() : end) - begin);
+    begin = line.find_first_not_of(whitespace, end);
+  }
+}
+
+static void report(
+  ParseResult & parseResult, std::size_t line, Diagnostic::Severity severity,
+  const std::string & message)
+{
+  if (severity == Diagnostic::Severity::Error) {
+    RCLCPP_ERROR_STREAM(logger, "line " << line << ": " << message);
+    parseResult.successful = false;
+  } else {
+    // Warnings are for nao_pos_lint, loading a motion at runtime should not flood the log
+    RCLCPP_DEBUG_STREAM(logger, "line " << line << ": " << message);
+  }
+  parseResult.diagnostics.push_back(Diagnostic{line, severity, message});
+}
+
+// Tokens are not null terminated, strtof / strtol need a copy. No number in a pos file is
+// anywhere near this long.
+static constexpr std::size_t MAX_NUMBER_LENGTH = 63;
+
+// Unlike plain std::stof / std::stoi, the whole string must be a finite number
+static bool toFloat(std::string_view str, float & value)
+{
+  char buffer[MAX_NUMBER_LENGTH + 1];
+  if (str.empty() || str.size() > MAX_NUMBER_LENGTH) {
+    return false;
+  }
+  std::memcpy(buffer, str.data(), str.size());
+  buffer[str.size()] = '\0';
+
+  char * end = nullptr;
+  errno = 0;
+  value = std::strtof(buffer, &end);
+  return errno != ERANGE && end == buffer + str.size() && std::isfinite(value);
+}
 
-ParseResult parse(const std::vector<std::string> & in)
+static bool toInt(std::string_view str, int & value)
 {
+  char buffer[MAX_NUMBER_LENGTH + 1];
+  if (str.empty() || str.size() > MAX_NUMBER_LENGTH) {
+    return false;
+  }
+  std::memcpy(buffer, str.data(), str.size());
+  buffer[str.size()] = '\0';
+
+  char * end = nullptr;
+  errno = 0;
+  long parsed = std::strtol(buffer, &end, 10);
+  if (errno == ERANGE || end != buffer + str.size() || parsed < INT_MIN || parsed > INT_MAX) {
+    return false;
+  }
+  value = static_cast<int>(parsed);
+  return true;
+}
+
+ParseResult parse(const std::vector<std::string> & in, std::pmr::memory_resource * scratch)
+{
+  using Severity = Diagnostic::Severity;
+
   ParseResult parseResult;
+  parseResult.successful = true;
+
+  // Reused for every line, grows once to the widest line
+  std::pmr::vector<std::string_view> splitted_line(scratch);
+
+  // Keyframes are moved in, one per joint line, so the vector never reallocates
+  parseResult.keyFrames.reserve(
+    std::count_if(
+      in.begin(), in.end(),
+      [](const std::string & line) {return !line.empty() && line.front() == '!';}));
 
   unsigned keyFrameTime = 0;
   auto jointStiffnesses = nao_lola_command_msgs::msg::JointStiffnesses();
   bool customStiffnesses = false;
-  bool firstPosLine = true;
-
-  nao_lola_command_msgs::msg::JointPositions prevJointPositions;
+  std::size_t stiffnessLine = 0;
+  KeyFrame::Support support = KeyFrame::Support::None;
+
+  for (std::size_t lineIndex = 0; lineIndex < in.size(); ++lineIndex) {
+    const auto & line = in[lineIndex];
+    const std::size_t lineNumber = lineIndex + 1;
+
+    if (!line.empty() && line.front() == '@') {
+      split(line, splitted_line);
+      static const std::pair<const char *, KeyFrame::Support> supports[] = {
+        {"none", KeyFrame::Support::None}, {"double", KeyFrame::Support::Double},
+        {"left", KeyFrame::Support::Left}, {"right", KeyFrame::Support::Right}};
+      auto it = std::find_if(
+        std::begin(supports), std::end(supports), [&splitted_line](const auto & entry) {
+          return splitted_line.size() == 3 && splitted_line[2] == entry.first;
+        });
+      if (splitted_line.size() == 4 && splitted_line[1] == "contact") {
+        parseResult.knownContacts.emplace_back(splitted_line[2], splitted_line[3]);
+      } else if (splitted_line.size() != 3 || splitted_line[1] != "support" ||
+        it == std::end(supports))
+      {
+        report(
+          parseResult, lineNumber, Severity::Error,
+          "expected '@ support none|double|left|right' or '@ contact <arm> <body>'");
+        return parseResult;
+      } else {
+        support = it->second;
+      }
 
-  for (const auto & line : in) {
-    if (line.front() == '$') {
+    } else if (!line.empty() && line.front() == '$') {
       RCLCPP_DEBUG_STREAM(logger, "Stiffness: " << line);
-      auto splitted_line = split(line);
+      split(line, splitted_line);
+
+      if (customStiffnesses) {
+        report(
+          parseResult, stiffnessLine, Severity::Error,
+          "stiffness line is not followed by a joint line");
+        return parseResult;
+      }
 
       // Check size
       if (splitted_line.size() != STIFFNESSES_SIZE) {
-        RCLCPP_ERROR_STREAM(
-          logger, "pos file line has " << splitted_line.size() << " elements, but expected "
-                                       << STIFFNESSES_SIZE);
-        parseResult.successful = false;
+        std::stringstream ss;
+        ss << "pos file line has " << splitted_line.size() << " elements, but expected "
+           << STIFFNESSES_SIZE;
+        report(parseResult, lineNumber, Severity::Error, ss.str());
         return parseResult;
       }
 
       customStiffnesses = true;
+      stiffnessLine = lineNumber;
+      jointStiffnesses.indexes.reserve(nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS);
+      jointStiffnesses.stiffnesses.reserve(nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS);
 
       for (unsigned int i = 1; i < nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS + 1; ++i) {
-        std::string stiffness_string = splitted_line.at(i);
+        std::string_view stiffness_string = splitted_line.at(i);
 
         if (stiffness_string != "-") {
-          try {
-            float stiffness_float = std::stof(stiffness_string);
-            jointStiffnesses.indexes.push_back(i - 1);
-            jointStiffnesses.stiffnesses.push_back(stiffness_float);
-          } catch (std::invalid_argument &) {
-            RCLCPP_ERROR(
-              logger, ("stiffness value '" + stiffness_string +
-                       "' is not a valid stiffness value (cannot be converted to float)")
-                        .c_str());
-            parseResult.successful = false;
+          float stiffness_float = 0;
+          if (!toFloat(stiffness_string, stiffness_float)) {
+            report(
+              parseResult, lineNumber, Severity::Error,
+              "stiffness value '" + std::string(stiffness_string) +
+              "' is not a valid stiffness value (cannot be converted to float)");
             return parseResult;
           }
+          if (stiffness_float < 0.0 || stiffness_float > 1.0) {
+            report(
+              parseResult, lineNumber, Severity::Warning,
+              indexes::names.at(i - 1) + " stiffness " + std::string(stiffness_string) +
+              " is outside [0, 1]");
+          }
+          jointStiffnesses.indexes.push_back(i - 1);
+          jointStiffnesses.stiffnesses.push_back(stiffness_float);
         }
       }
 
-    } else if (line.front() == '!') {
+    } else if (!line.empty() && line.front() == '!') {
       RCLCPP_DEBUG_STREAM(logger, "Position: " << line);
-      auto splitted_line = split(line);
+      split(line, splitted_line);
 
       // Check size
       if (splitted_line.size() != POSITIONS_SIZE) {
-        RCLCPP_ERROR_STREAM(
-          logger, "pos file line has " << splitted_line.size() << " elements, but expected "
-                                       << POSITIONS_SIZE);
-        parseResult.successful = false;
+        std::stringstream ss;
+        ss << "pos file line has " << splitted_line.size() << " elements, but expected "
+           << POSITIONS_SIZE;
+        report(parseResult, lineNumber, Severity::Error, ss.str());
         return parseResult;
       }
 
       // Convert to data type. Pos files specify angles in degrees while nao_lola uses radians
       nao_lola_command_msgs::msg::JointPositions jointPositions;
+      jointPositions.indexes.reserve(nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS);
+      jointPositions.positions.reserve(nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS);
+      if (!customStiffnesses) {
+        jointStiffnesses.indexes.reserve(nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS);
+        jointStiffnesses.stiffnesses.reserve(nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS);
+      }
 
       for (unsigned int i = 1; i < nao_lola_command_msgs::msg::JointIndexes::NUMJOINTS + 1; ++i) {
-        std::string position_deg_string = splitted_line.at(i);
+        std::string_view position_deg_string = splitted_line.at(i);
 
         if (position_deg_string != "-") {
-          try {
-            float position_deg = std::stof(position_deg_string);
-            float position_rad = position_deg * M_PI / 180;
-            jointPositions.indexes.push_back(i - 1);
-            jointPositions.positions.push_back(position_rad);
-            if (!customStiffnesses) {
-              jointStiffnesses.indexes.push_back(i - 1);
-              jointStiffnesses.stiffnesses.push_back(1.0);
-            }
-          } catch (std::invalid_argument &) {
-            RCLCPP_ERROR(
-              logger, ("joint value '" + position_deg_string +
-                       "' is not a valid joint value (cannot be converted to float)")
-                        .c_str());
-            parseResult.successful = false;
+          float position_deg = 0;
+          if (!toFloat(position_deg_string, position_deg)) {
+            report(
+              parseResult, lineNumber, Severity::Error,
+              "joint value '" + std::string(position_deg_string) +
+              "' is not a valid joint value (cannot be converted to float)");
             return parseResult;
           }
+          const auto & limits = joint_limits::degrees[i - 1];
+          if (position_deg < limits.min || position_deg > limits.max) {
+            std::stringstream ss;
+            ss << indexes::names.at(i - 1) << " value " << position_deg_string
+               << " is outside the joint limits [" << limits.min << ", " << limits.max << "]";
+            report(parseResult, lineNumber, Severity::Warning, ss.str());
+          }
+          float position_rad = position_deg * M_PI / 180;
+          jointPositions.indexes.push_back(i - 1);
+          jointPositions.positions.push_back(position_rad);
+          if (!customStiffnesses) {
+            jointStiffnesses.indexes.push_back(i - 1);
+            jointStiffnesses.stiffnesses.push_back(1.0);
+          }
         }
       }
 
-      if (firstPosLine) {
-        firstPosLine = false;
-      } else {
-        if (jointPositions.indexes != prevJointPositions.indexes) {
-          RCLCPP_ERROR_STREAM(logger, "two or more joint positions vectors are not the same!");
-          parseResult.successful = false;
-          return parseResult;
-        }
+      if (!parseResult.keyFrames.empty() &&
+        jointPositions.indexes != parseResult.keyFrames.back().positions.indexes)
+      {
+        report(
+          parseResult, lineNumber, Severity::Error,
+          "two or more joint positions vectors are not the same!");
+        return parseResult;
       }
 
       // add the duration of the Keyframe
-      std::string duration_string = splitted_line.back();
-      try {
-        int duration = std::stoi(duration_string);
-        keyFrameTime += duration;
-      } catch (std::invalid_argument &) {
-        RCLCPP_ERROR(
-          logger, ("duration '" + duration_string +
-                   "' is not a valid duration value (cannot be converted to int)")
-                    .c_str());
-        parseResult.successful = false;
+      std::string_view duration_string = splitted_line.back();
+      int duration = 0;
+      if (!toInt(duration_string, duration) || duration < 0) {
+        report(
+          parseResult, lineNumber, Severity::Error,
+          "duration '" + std::string(duration_string) +
+          "' is not a valid duration value (cannot be converted to a non-negative int)");
         return parseResult;
       }
+      if (duration == 0) {
+        report(
+          parseResult, lineNumber, Severity::Warning,
+          "zero duration, the joints jump to this keyframe");
+      }
+      keyFrameTime += duration;
 
       if (customStiffnesses) {
         if (jointPositions.indexes.size() != jointStiffnesses.indexes.size()) {
-          RCLCPP_ERROR(logger, "joint positions and joint stiffness vectors have different sizes!");
-          parseResult.successful = false;
+          report(
+            parseResult, lineNumber, Severity::Error,
+            "joint positions and joint stiffness vectors have different sizes!");
           return parseResult;
         }
         for (unsigned i = 0; i < jointPositions.indexes.size(); i++) {
           if (jointPositions.indexes.at(i) != jointStiffnesses.indexes.at(i)) {
-            RCLCPP_ERROR(logger, "joint positions and joint stiffness indexes are not the same!");
-            parseResult.successful = false;
+            report(
+              parseResult, lineNumber, Severity::Error,
+              "joint positions and joint stiffness indexes are not the same!");
             return parseResult;
           }
         }
       }
 
-      parseResult.keyFrames.push_back(KeyFrame{keyFrameTime, jointPositions, jointStiffnesses});
-      RCLCPP_INFO_STREAM(logger, "jointPositions indexes: " << vec2str(jointPositions.indexes));
-      RCLCPP_INFO_STREAM(logger, "jointPositions size: " << jointPositions.indexes.size());
-      RCLCPP_INFO_STREAM(logger, "jointStiffnesses indexes: " << vec2str(jointStiffnesses.indexes));
-      RCLCPP_INFO_STREAM(logger, "jointStiffnesses size: " << jointStiffnesses.indexes.size());
-
-      prevJointPositions = jointPositions;  // Using assignment operator to copy one vector to other
-
-      jointStiffnesses.stiffnesses.clear();
-      jointStiffnesses.indexes.clear();
+      auto & keyFrame = parseResult.keyFrames.emplace_back(
+        keyFrameTime, std::move(jointPositions), std::move(jointStiffnesses));
+      keyFrame.support = support;
+      RCLCPP_DEBUG_STREAM(
+        logger, "jointPositions indexes: " << vec2str(keyFrame.positions.indexes));
+      RCLCPP_DEBUG_STREAM(logger, "jointPositions size: " << keyFrame.positions.indexes.size());
+      RCLCPP_DEBUG_STREAM(
+        logger, "jointStiffnesses indexes: " << vec2str(keyFrame.stiffnesses.indexes));
+      RCLCPP_DEBUG_STREAM(logger, "jointStiffnesses size: " << keyFrame.stiffnesses.indexes.size());
+
+      // Moved from, start the next keyframe from an empty message
+      jointStiffnesses = nao_lola_command_msgs::msg::JointStiffnesses();
       customStiffnesses = false;
 
     } else {
@@ -199,15 +340,26 @@ ParseResult parse(const std::vector<std::string> & in)
     }
   }  // for each line of in
 
-  parseResult.successful = true;
+  if (customStiffnesses) {
+    report(
+      parseResult, stiffnessLine, Severity::Error,
+      "stiffness line is not followed by a joint line");
+  }
+
   return parseResult;
 }
 
-std::vector<std::string> split(const std::string & line)
+std::vector<std::string> readLines(std::istream & in)
 {
-  std::istringstream ss(line);
-  return std::vector<std::string>{
-    std::istream_iterator<std::string>{ss}, std::istream_iterator<std::string>()};
+  std::vector<std::string> ret;
+
+  while (!in.eof()) {
+    std::string line;
+    std::getline(in, line);
+    ret.push_back(line);
+  }
+
+  return ret;
 }
 
 }  // namespace parser
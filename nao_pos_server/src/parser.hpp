@@ -15,7 +15,11 @@
 #ifndef PARSER_HPP_
 #define PARSER_HPP_
 
+#include <cstddef>
+#include <istream>
+#include <memory_resource>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "nao_pos_server/key_frame.hpp"
@@ -23,13 +27,32 @@
 namespace parser
 {
 
+struct Diagnostic
+{
+  enum class Severity { Warning, Error };
+
+  std::size_t line;  // 1-based index in the parsed lines
+  Severity severity;
+  std::string message;
+};
+
 struct ParseResult
 {
   bool successful;
   std::vector<KeyFrame> keyFrames;
+  // Parsing stops at the first error, so at most the last diagnostic is an error
+  std::vector<Diagnostic> diagnostics;
+  // Self collisions the file declares intended, as (arm, body) capsule names, from its
+  // '@ contact <arm> <body>' lines (see collision::dropKnown)
+  std::vector<std::pair<std::string, std::string>> knownContacts;
 };
 
-ParseResult parse(const std::vector<std::string> & in);
+// Temporary buffers of the parsing (line tokens) are allocated from scratch
+ParseResult parse(
+  const std::vector<std::string> & in,
+  std::pmr::memory_resource * scratch = std::pmr::get_default_resource());
+
+std::vector<std::string> readLines(std::istream & in);
 
 }  // namespace parser
 
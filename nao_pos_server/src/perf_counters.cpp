@@ -0,0 +1,141 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "nao_pos_server/perf_counters.hpp"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+
+namespace stats
+{
+
+static const uint64_t configs[PerfCounters::NUM_COUNTERS] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES};
+
+namespace
+{
+
+// The counters of one thread, opened as a group on first use and closed when the thread exits
+struct ThreadCounters
+{
+  std::array<int, PerfCounters::NUM_COUNTERS> fds;
+  std::array<int, PerfCounters::NUM_COUNTERS> positions;  // in the group read, -1 if not available
+  int leader = -1;
+  std::size_t numOpen = 0;
+
+  ThreadCounters()
+  {
+    fds.fill(-1);
+    positions.fill(-1);
+    for (std::size_t c = 0; c < PerfCounters::NUM_COUNTERS; ++c) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[c];
+      attr.read_format = PERF_FORMAT_GROUP;
+      // User space only, which the default perf_event_paranoid level allows
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      // The first counter opened leads the group, so all of them count over the same time
+      fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+      if (fds[c] < 0) {
+        continue;
+      }
+      if (leader < 0) {
+        leader = fds[c];
+      }
+      positions[c] = numOpen++;
+    }
+  }
+
+  ~ThreadCounters()
+  {
+    for (int fd : fds) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+
+  // Reads every open counter with a single system call
+  bool read(PerfCounters::Values & values) const
+  {
+    // Layout of a group read: the number of counters, then their values in opening order
+    uint64_t buffer[1 + PerfCounters::NUM_COUNTERS];
+    if (numOpen == 0 ||
+      ::read(leader, buffer, sizeof(buffer)) < static_cast<ssize_t>((1 + numOpen) * 8))
+    {
+      return false;
+    }
+    for (std::size_t c = 0; c < PerfCounters::NUM_COUNTERS; ++c) {
+      values[c] = positions[c] >= 0 ? buffer[1 + positions[c]] : 0;
+    }
+    return true;
+  }
+};
+
+const ThreadCounters & threadCounters()
+{
+  thread_local const ThreadCounters counters;
+  return counters;
+}
+
+}  // namespace
+
+PerfCounters::PerfCounters()
+{
+  const ThreadCounters & counters = threadCounters();
+  for (std::size_t c = 0; c < NUM_COUNTERS; ++c) {
+    available_[c] = counters.positions[c] >= 0;
+  }
+}
+
+bool PerfCounters::anyAvailable() const
+{
+  for (bool available : available_) {
+    if (available) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PerfCounters::start()
+{
+  started_ = threadCounters().read(start_);
+}
+
+PerfCounters::Values PerfCounters::stop()
+{
+  Values values{};
+  if (!started_ || !threadCounters().read(values)) {
+    return Values{};
+  }
+  started_ = false;
+  for (std::size_t c = 0; c < NUM_COUNTERS; ++c) {
+    values[c] -= start_[c];
+  }
+  return values;
+}
+
+}  // namespace stats
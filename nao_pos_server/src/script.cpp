@@ -0,0 +1,136 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "script.hpp"
+
+#include <map>
+#include <string>
+#include <utility>
+
+namespace script
+{
+
+Script::Script(Script && other) noexcept
+: handle_(std::exchange(other.handle_, nullptr))
+{
+}
+
+Script & Script::operator=(Script && other) noexcept
+{
+  if (this != &other) {
+    if (handle_) {
+      handle_.destroy();
+    }
+    handle_ = std::exchange(other.handle_, nullptr);
+  }
+  return *this;
+}
+
+Script::~Script()
+{
+  if (handle_) {
+    handle_.destroy();
+  }
+}
+
+bool Script::tick()
+{
+  auto & promise = handle_.promise();
+  if (handle_.done() || promise.failed) {
+    return false;
+  }
+  // An await already satisfied when it suspends (e.g. joints already converged) does not cost
+  // a tick, the script keeps running until it waits for something
+  while (true) {
+    if (promise.awaiting) {
+      if (!promise.awaiting->ready(promise)) {
+        return true;
+      }
+      promise.awaiting = nullptr;
+      if (promise.failed) {
+        return false;
+      }
+    }
+    handle_.resume();
+    if (handle_.done() || promise.failed) {
+      return false;
+    }
+  }
+}
+
+void Play::await_suspend(std::coroutine_handle<Script::promise_type> handle)
+{
+  auto & promise = handle.promise();
+  if (!promise.player->start(motion)) {
+    promise.failed = true;
+    return;
+  }
+  promise.awaiting = this;
+}
+
+bool Play::ready(Script::promise_type & promise)
+{
+  Player & player = *promise.player;
+  if (player.playing()) {
+    return false;
+  }
+  if (left > 0) {
+    --left;
+    promise.failed = !player.start(motion);
+    return promise.failed;
+  }
+  return true;
+}
+
+void UntilConverged::await_suspend(std::coroutine_handle<Script::promise_type> handle)
+{
+  handle.promise().awaiting = this;
+}
+
+bool UntilConverged::ready(Script::promise_type & promise)
+{
+  if (promise.player->trackingError() <= tolerance) {
+    return true;
+  }
+  promise.failed = --left <= 0;
+  return promise.failed;
+}
+
+static Script standAndTalk()
+{
+  co_await play("sit-to-stand");
+  co_await untilConverged();
+  co_await playLooped("talking", 3);
+}
+
+static Script getUpFront()
+{
+  co_await play("getupFront");
+  co_await untilConverged(0.1f);
+  co_await play("stand");
+}
+
+const Entry * find(const std::string & name)
+{
+  static const std::map<std::string, Entry> scripts = {
+    {"stand_and_talk", {standAndTalk, {"sit-to-stand", "talking"}}},
+    {"get_up_front", {getUpFront, {"getupFront", "stand"}}},
+  };
+
+  auto it = scripts.find(name);
+  return it == scripts.end() ? nullptr : &it->second;
+}
+
+}  // namespace script
@@ -0,0 +1,155 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SCRIPT_HPP_
+#define SCRIPT_HPP_
+
+// C++20: only included by the translation units of nao_pos_server_node, which is built with
+// cxx_std_20. The public headers stay C++17.
+
+#include <coroutine>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace script
+{
+
+// What a script can do with the action server playing it. Every call happens on the playback
+// thread, from the tick.
+struct Player
+{
+  // Starts the motion from the current tick, false if it was not prepared for the goal
+  std::function<bool(const char *)> start;
+  // The last started motion has not finished yet
+  std::function<bool()> playing;
+  // Max error (rad) between the last command and the sensed pose, over the commanded joints
+  std::function<float()> trackingError;
+};
+
+// A composite behaviour written as a coroutine:
+//
+//   Script standAndTalk()
+//   {
+//     co_await play("sit-to-stand");
+//     co_await untilConverged();
+//     co_await playLooped("talking", 3);
+//   }
+//
+// The script does not run by itself: the server calls tick() once per playback tick, and the
+// script resumes at the first tick where what it awaits is done. Ticks do not allocate: the
+// coroutine frame, awaiters included, is allocated once by create().
+class Script
+{
+public:
+  struct promise_type;
+
+  // What a suspended script waits for. The awaiter lives in the coroutine frame until the script
+  // resumes.
+  struct Awaiter
+  {
+    // Checked at every tick, true once the script can resume
+    virtual bool ready(promise_type & promise) = 0;
+
+  protected:
+    ~Awaiter() = default;
+  };
+
+  struct promise_type
+  {
+    Player * player = nullptr;
+    Awaiter * awaiting = nullptr;
+    bool failed = false;
+
+    Script get_return_object()
+    {
+      return Script{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept {return {};}
+    std::suspend_always final_suspend() noexcept {return {};}
+    void return_void() {}
+    void unhandled_exception() {failed = true;}
+  };
+
+  Script(Script && other) noexcept;
+  Script & operator=(Script && other) noexcept;
+  ~Script();
+
+  // The script starts running at the first tick
+  void start(Player * player) {handle_.promise().player = player;}
+  // Resumes the script if what it awaits is done. Returns false once the script is over.
+  bool tick();
+  bool failed() const {return handle_.promise().failed;}
+
+private:
+  explicit Script(std::coroutine_handle<promise_type> handle)
+  : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Plays a motion, resuming the script at the tick it ends. The script fails if it was not
+// prepared for the goal. motion must outlive the script, scripts pass string literals.
+struct Play : Script::Awaiter
+{
+  Play(const char * motion, int times)
+  : motion(motion), left(times - 1) {}
+
+  bool await_ready() const noexcept {return false;}
+  void await_suspend(std::coroutine_handle<Script::promise_type> handle);
+  void await_resume() const noexcept {}
+  bool ready(Script::promise_type & promise) override;
+
+  const char * motion;
+  int left;  // plays after the current one
+};
+
+// Resumes the script once the joints are within tolerance of the last command. The script
+// fails if they are not after timeoutTicks ticks.
+struct UntilConverged : Script::Awaiter
+{
+  UntilConverged(float tolerance, int timeoutTicks)
+  : tolerance(tolerance), left(timeoutTicks) {}
+
+  bool await_ready() const noexcept {return false;}
+  void await_suspend(std::coroutine_handle<Script::promise_type> handle);
+  void await_resume() const noexcept {}
+  bool ready(Script::promise_type & promise) override;
+
+  float tolerance;
+  int left;  // ticks before timing out
+};
+
+inline Play play(const char * motion) {return Play{motion, 1};}
+inline Play playLooped(const char * motion, int times) {return Play{motion, times};}
+inline UntilConverged untilConverged(float tolerance = 0.05f, int timeoutTicks = 100)
+{
+  return UntilConverged{tolerance, timeoutTicks};
+}
+
+struct Entry
+{
+  Script (* create)();
+  // Motions the script plays, loaded when the goal is received so that a missing file rejects
+  // the goal and the playback thread never parses
+  std::vector<std::string> motions;
+};
+
+// Scripts are requested as "script/<name>" goals. nullptr if there is no such script.
+const Entry * find(const std::string & name);
+
+}  // namespace script
+
+#endif  // SCRIPT_HPP_
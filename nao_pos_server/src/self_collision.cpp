@@ -0,0 +1,180 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "nao_pos_server/self_collision.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nao_pos_server/kinematics.hpp"
+
+namespace collision
+{
+
+using kinematics::Body;
+using kinematics::Vec3;
+
+struct Capsule
+{
+  Vec3 from;
+  Vec3 to;
+  float radius;
+};
+
+static constexpr float ARM_RADIUS = 20.0f;
+static constexpr float LEG_RADIUS = 35.0f;
+static constexpr float TORSO_RADIUS = 50.0f;
+
+static constexpr std::size_t NUM_ARM_CAPSULES = 4;
+static constexpr std::size_t NUM_BODY_CAPSULES = 5;
+static const char * ARM_NAMES[NUM_ARM_CAPSULES] = {
+  "LUpperArm", "LForeArm", "RUpperArm", "RForeArm"};
+static const char * BODY_NAMES[NUM_BODY_CAPSULES] = {
+  "Torso", "LThigh", "LTibia", "RThigh", "RTibia"};
+
+static void armCapsules(const Body & body, Capsule * out)
+{
+  const Vec3 hand{kinematics::HAND_LENGTH, 0.0f, 0.0f};
+  out[0] = {body.lUpperArm.position, body.lForeArm.position, ARM_RADIUS};
+  out[1] = {body.lForeArm.position, body.lForeArm.transform(hand), ARM_RADIUS};
+  out[2] = {body.rUpperArm.position, body.rForeArm.position, ARM_RADIUS};
+  out[3] = {body.rForeArm.position, body.rForeArm.transform(hand), ARM_RADIUS};
+}
+
+static void bodyCapsules(const Body & body, Capsule * out)
+{
+  out[0] = {{0.0f, 0.0f, -40.0f}, {0.0f, 0.0f, 60.0f}, TORSO_RADIUS};
+  out[1] = {body.lThigh.position, body.lTibia.position, LEG_RADIUS};
+  out[2] = {body.lTibia.position, body.lFoot.position, LEG_RADIUS};
+  out[3] = {body.rThigh.position, body.rTibia.position, LEG_RADIUS};
+  out[4] = {body.rTibia.position, body.rFoot.position, LEG_RADIUS};
+}
+
+static Vec3 sub(const Vec3 & a, const Vec3 & b) {return {a.x - b.x, a.y - b.y, a.z - b.z};}
+static float dot(const Vec3 & a, const Vec3 & b) {return a.x * b.x + a.y * b.y + a.z * b.z;}
+
+// Distance between the segments [p1, q1] and [p2, q2] (Ericson, Real-Time Collision Detection)
+static float segmentDistance(const Vec3 & p1, const Vec3 & q1, const Vec3 & p2, const Vec3 & q2)
+{
+  const Vec3 d1 = sub(q1, p1);
+  const Vec3 d2 = sub(q2, p2);
+  const Vec3 r = sub(p1, p2);
+  const float a = dot(d1, d1);
+  const float e = dot(d2, d2);
+  const float f = dot(d2, r);
+  float s = 0.0f;
+  float t = 0.0f;
+
+  if (a <= 1e-6f && e <= 1e-6f) {
+    return std::sqrt(dot(r, r));
+  }
+  if (a <= 1e-6f) {
+    t = std::clamp(f / e, 0.0f, 1.0f);
+  } else {
+    const float c = dot(d1, r);
+    if (e <= 1e-6f) {
+      s = std::clamp(-c / a, 0.0f, 1.0f);
+    } else {
+      const float b = dot(d1, d2);
+      const float denom = a * e - b * b;
+      s = denom > 0.0f ? std::clamp((b * f - c * e) / denom, 0.0f, 1.0f) : 0.0f;
+      t = (b * s + f) / e;
+      if (t < 0.0f) {
+        t = 0.0f;
+        s = std::clamp(-c / a, 0.0f, 1.0f);
+      } else if (t > 1.0f) {
+        t = 1.0f;
+        s = std::clamp((b - c) / a, 0.0f, 1.0f);
+      }
+    }
+  }
+
+  const Vec3 closest1{p1.x + d1.x * s, p1.y + d1.y * s, p1.z + d1.z * s};
+  const Vec3 closest2{p2.x + d2.x * t, p2.y + d2.y * t, p2.z + d2.z * t};
+  const Vec3 gap = sub(closest1, closest2);
+  return std::sqrt(dot(gap, gap));
+}
+
+std::vector<Contact> check(const motion::Motion & motion, float sample_period_ms)
+{
+  std::vector<float> times_ms;
+  std::vector<float> poses;
+  kinematics::samplePoses(motion, sample_period_ms, times_ms, poses);
+  std::vector<Body> bodies(times_ms.size());
+  kinematics::forwardKinematics(poses.data(), times_ms.size(), bodies.data());
+
+  std::vector<Contact> contacts;
+  // Contact of each pair still going on at the previous sample, an index into contacts
+  constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+  std::vector<std::size_t> open(NUM_ARM_CAPSULES * NUM_BODY_CAPSULES, NONE);
+
+  for (std::size_t s = 0; s < bodies.size(); ++s) {
+    Capsule arms[NUM_ARM_CAPSULES];
+    Capsule body[NUM_BODY_CAPSULES];
+    armCapsules(bodies[s], arms);
+    bodyCapsules(bodies[s], body);
+
+    for (std::size_t a = 0; a < NUM_ARM_CAPSULES; ++a) {
+      for (std::size_t b = 0; b < NUM_BODY_CAPSULES; ++b) {
+        const float depth = arms[a].radius + body[b].radius -
+          segmentDistance(arms[a].from, arms[a].to, body[b].from, body[b].to);
+        std::size_t & pair = open[a * NUM_BODY_CAPSULES + b];
+        if (depth <= 0.0f) {
+          pair = NONE;
+        } else if (pair == NONE) {
+          pair = contacts.size();
+          contacts.push_back({ARM_NAMES[a], BODY_NAMES[b], times_ms[s], times_ms[s], depth});
+        } else {
+          contacts[pair].end_ms = times_ms[s];
+          contacts[pair].depth_mm = std::max(contacts[pair].depth_mm, depth);
+        }
+      }
+    }
+  }
+
+  std::stable_sort(
+    contacts.begin(), contacts.end(), [](const Contact & a, const Contact & b) {
+      return a.start_ms < b.start_ms;
+    });
+  return contacts;
+}
+
+void dropKnown(
+  std::vector<Contact> & contacts, const std::vector<std::pair<std::string, std::string>> & known)
+{
+  contacts.erase(
+    std::remove_if(
+      contacts.begin(), contacts.end(), [&known](const Contact & contact) {
+        return std::find(
+          known.begin(), known.end(), std::make_pair(
+            std::string(contact.arm), std::string(contact.body))) != known.end();
+      }),
+    contacts.end());
+}
+
+std::string describe(const Contact & contact)
+{
+  char buffer[128];
+  std::snprintf(
+    buffer, sizeof(buffer), "%s collides with %s from %.0f ms to %.0f ms (%.1f mm deep)",
+    contact.arm, contact.body, contact.start_ms, contact.end_ms, contact.depth_mm);
+  return buffer;
+}
+
+}  // namespace collision
@@ -0,0 +1,238 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "nao_pos_server/stability.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "nao_pos_server/kinematics.hpp"
+
+namespace stability
+{
+
+using kinematics::Body;
+using kinematics::Frame;
+using kinematics::Vec3;
+
+struct Point
+{
+  float x;
+  float y;
+};
+
+static constexpr float GRAVITY_MM_PER_MS2 = 9.81e-3f;
+
+static float cross(const Point & o, const Point & a, const Point & b)
+{
+  return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+// Counterclockwise convex hull (Andrew's monotone chain)
+static std::vector<Point> convexHull(std::vector<Point> points)
+{
+  std::sort(
+    points.begin(), points.end(), [](const Point & a, const Point & b) {
+      return a.x < b.x || (a.x == b.x && a.y < b.y);
+    });
+  std::vector<Point> hull(2 * points.size());
+  std::size_t size = 0;
+  for (std::size_t i = 0; i < points.size(); ++i) {
+    while (size >= 2 && cross(hull[size - 2], hull[size - 1], points[i]) <= 0.0f) {
+      --size;
+    }
+    hull[size++] = points[i];
+  }
+  for (std::size_t i = points.size() - 1, lower = size + 1; i-- > 0; ) {
+    while (size >= lower && cross(hull[size - 2], hull[size - 1], points[i]) <= 0.0f) {
+      --size;
+    }
+    hull[size++] = points[i];
+  }
+  hull.resize(size - 1);
+  return hull;
+}
+
+// Sole corners of foot, in the frame of reference
+static void addSole(const Frame & reference, const Frame & foot, std::vector<Point> & points)
+{
+  using kinematics::SOLE_BACK;
+  using kinematics::SOLE_FRONT;
+  using kinematics::SOLE_HALF_WIDTH;
+  const Vec3 corners[] = {
+    {SOLE_FRONT, SOLE_HALF_WIDTH, -kinematics::FOOT_HEIGHT},
+    {SOLE_FRONT, -SOLE_HALF_WIDTH, -kinematics::FOOT_HEIGHT},
+    {SOLE_BACK, -SOLE_HALF_WIDTH, -kinematics::FOOT_HEIGHT},
+    {SOLE_BACK, SOLE_HALF_WIDTH, -kinematics::FOOT_HEIGHT}};
+  for (const auto & corner : corners) {
+    const Vec3 point = reference.inverseTransform(foot.transform(corner));
+    points.push_back({point.x, point.y});
+  }
+}
+
+// Inward normal of each counterclockwise edge, dotted with the offset from its first vertex
+static float edgeDistance(const Point & a, const Point & b, const Point & p)
+{
+  const float dx = b.x - a.x;
+  const float dy = b.y - a.y;
+  const float length = std::sqrt(dx * dx + dy * dy);
+  return (-dy * (p.x - a.x) + dx * (p.y - a.y)) / length;
+}
+
+// Signed distance to the polygon edges, positive inside
+static float margin(const std::vector<Point> & polygon, const Point & p)
+{
+  float result = std::numeric_limits<float>::max();
+  for (std::size_t i = 0; i < polygon.size(); ++i) {
+    result = std::min(result, edgeDistance(polygon[i], polygon[(i + 1) % polygon.size()], p));
+  }
+  return result;
+}
+
+// Largest t keeping p + t * direction inside the polygon, p being inside
+static float exitDistance(
+  const std::vector<Point> & polygon, const Point & p, const Point & direction)
+{
+  float result = std::numeric_limits<float>::infinity();
+  for (std::size_t i = 0; i < polygon.size(); ++i) {
+    const Point & a = polygon[i];
+    const Point & b = polygon[(i + 1) % polygon.size()];
+    const float approach =
+      edgeDistance(a, b, {p.x + direction.x, p.y + direction.y}) - edgeDistance(a, b, p);
+    if (approach < 0.0f) {
+      result = std::min(result, edgeDistance(a, b, p) / -approach);
+    }
+  }
+  return result;
+}
+
+static Segment analyzeSegment(
+  const motion::Motion & motion, std::size_t segment, float sample_period_ms)
+{
+  const unsigned start_ms = motion.timeMs(segment - 1);
+  const unsigned duration_ms = motion.timeMs(segment) - start_ms;
+  const KeyFrame::Support support = motion.support(segment);
+
+  // Sample u = i / intervals of the segment, for i in [0, intervals]
+  const std::size_t intervals =
+    duration_ms == 0 ? 0 : std::max<std::size_t>(2, std::ceil(duration_ms / sample_period_ms));
+  const std::size_t numSamples = intervals + 1;
+  const std::size_t numJoints = motion.numJoints();
+  const auto joints = motion.joints();
+
+  std::vector<float> poses(numSamples * kinematics::NUM_JOINTS);
+  std::vector<float> positions(numJoints);
+  std::vector<float> stiffnesses(numJoints);
+  for (std::size_t i = 0; i < numSamples; ++i) {
+    const float u = intervals == 0 ? 1.0f : static_cast<float>(i) / intervals;
+    motion.interpolate(segment, u, motion.positions(0), positions.data(), stiffnesses.data());
+    float * pose = &poses[i * kinematics::NUM_JOINTS];
+    std::copy(kinematics::neutralPose(), kinematics::neutralPose() + kinematics::NUM_JOINTS, pose);
+    for (std::size_t j = 0; j < numJoints; ++j) {
+      pose[joints[j]] = positions[j];
+    }
+  }
+  std::vector<Body> bodies(numSamples);
+  kinematics::forwardKinematics(poses.data(), numSamples, bodies.data());
+
+  // CoM (x, y, height above the sole) and support polygon of each sample, in the support foot
+  // frame. In double support both feet are flat on the ground, the left one is the reference.
+  std::vector<Vec3> coms(numSamples);
+  std::vector<std::vector<Point>> polygons(numSamples);
+  for (std::size_t i = 0; i < numSamples; ++i) {
+    const Body & body = bodies[i];
+    const Frame & reference = support == KeyFrame::Support::Right ? body.rFoot : body.lFoot;
+    const Vec3 com = reference.inverseTransform(kinematics::centerOfMass(body));
+    coms[i] = {com.x, com.y, com.z + kinematics::FOOT_HEIGHT};
+    std::vector<Point> corners;
+    if (support != KeyFrame::Support::Right) {
+      addSole(reference, body.lFoot, corners);
+    }
+    if (support != KeyFrame::Support::Left) {
+      addSole(reference, body.rFoot, corners);
+    }
+    polygons[i] = convexHull(corners);
+  }
+
+  Segment result{segment, support, duration_ms, std::numeric_limits<float>::max(), 0.0f, 0.0f, 0};
+  float maxInverseDuration2 = std::numeric_limits<float>::infinity();  // 1 / T^2 in 1 / ms^2
+  for (std::size_t i = 0; i < numSamples; ++i) {
+    const Point com{coms[i].x, coms[i].y};
+    const float sampleMargin = margin(polygons[i], com);
+    if (sampleMargin < 0.0f) {
+      const float time_ms =
+        start_ms + duration_ms * (intervals == 0 ? 1.0f : static_cast<float>(i) / intervals);
+      if (result.margin_mm >= 0.0f) {
+        result.unstable_from_ms = time_ms;
+      }
+      result.unstable_to_ms = time_ms;
+    }
+    result.margin_mm = std::min(result.margin_mm, sampleMargin);
+
+    // Acceleration over the normalized time u, by central differences
+    if (i == 0 || i == intervals || sampleMargin < 0.0f) {
+      continue;
+    }
+    const float scale = coms[i].z / GRAVITY_MM_PER_MS2 * intervals * intervals;
+    const Point shift{
+      -scale * (coms[i + 1].x - 2.0f * coms[i].x + coms[i - 1].x),
+      -scale * (coms[i + 1].y - 2.0f * coms[i].y + coms[i - 1].y)};
+    maxInverseDuration2 = std::min(maxInverseDuration2, exitDistance(polygons[i], com, shift));
+  }
+
+  if (result.margin_mm < 0.0f) {
+    result.min_duration_ms = Segment::NEVER;
+  } else if (std::isfinite(maxInverseDuration2) && maxInverseDuration2 > 0.0f) {
+    result.min_duration_ms = std::ceil(1.0f / std::sqrt(maxInverseDuration2));
+  }
+  return result;
+}
+
+std::vector<Segment> analyze(const motion::Motion & motion, float sample_period_ms)
+{
+  std::vector<Segment> segments;
+  for (std::size_t segment = 1; segment < motion.numKeyFrames(); ++segment) {
+    if (motion.support(segment) != KeyFrame::Support::None) {
+      segments.push_back(analyzeSegment(motion, segment, sample_period_ms));
+    }
+  }
+  return segments;
+}
+
+std::string describe(const Segment & segment)
+{
+  static const char * supportNames[] = {"no", "double", "left", "right"};
+  char buffer[160];
+  const char * support = supportNames[static_cast<int>(segment.support)];
+  if (segment.margin_mm < 0.0f) {
+    std::snprintf(
+      buffer, sizeof(buffer),
+      "segment %zu (%s support): CoM outside the support polygon from %.0f ms to %.0f ms "
+      "(%.1f mm out)", segment.segment, support, segment.unstable_from_ms,
+      segment.unstable_to_ms, -segment.margin_mm);
+  } else {
+    std::snprintf(
+      buffer, sizeof(buffer),
+      "segment %zu (%s support): %u ms, ZMP leaves the support polygon under %u ms",
+      segment.segment, support, segment.duration_ms, segment.min_duration_ms);
+  }
+  return buffer;
+}
+
+}  // namespace stability
@@ -0,0 +1,224 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+#include "nao_lola_command_msgs/msg/joint_positions.hpp"
+#include "nao_lola_sensor_msgs/msg/joint_positions.hpp"
+#include "nao_pos_interfaces/action/pos_play.hpp"
+#include "nao_pos_server/nao_pos_action_server.hpp"
+#include "rclcpp/rclcpp.hpp"
+#include "rclcpp_action/rclcpp_action.hpp"
+
+using JointIndexes = nao_lola_command_msgs::msg::JointIndexes;
+using PosPlay = nao_pos_interfaces::action::PosPlay;
+using namespace std::chrono_literals;
+
+// Action server, action client and a simulated robot, spun by the test. The robot applies the
+// published commands after actuation_delay_, moving each joint by at most max_step_ per sample.
+// Only embedded motions are played, so no pos file is needed.
+class TestActionServer : public testing::Test
+{
+protected:
+  static void SetUpTestSuite() {rclcpp::init(0, nullptr);}
+  static void TearDownTestSuite() {rclcpp::shutdown();}
+
+  void SetUp() override
+  {
+    robot_ = std::make_shared<rclcpp::Node>("test_robot");
+    client_ = rclcpp_action::create_client<PosPlay>(robot_, "nao_pos_action");
+    pub_sensor_ = robot_->create_publisher<nao_lola_sensor_msgs::msg::JointPositions>(
+      "/sensors/joint_positions", rclcpp::SensorDataQoS());
+    sub_command_ = robot_->create_subscription<nao_lola_command_msgs::msg::JointPositions>(
+      "/effectors/joint_positions", rclcpp::SensorDataQoS(),
+      [this](nao_lola_command_msgs::msg::JointPositions::SharedPtr command) {
+        commands_.emplace_back(std::chrono::steady_clock::now(), std::move(command));
+      });
+    executor_.add_node(robot_);
+    max_step_.fill(std::numeric_limits<float>::infinity());
+  }
+
+  // Starts the action server with these parameters
+  void startServer(std::vector<rclcpp::Parameter> parameters = {})
+  {
+    parameters.emplace_back("recorder.capacity", 0);
+    rclcpp::NodeOptions options;
+    options.parameter_overrides(parameters);
+    server_ = std::make_shared<nao_pos_action_server_ns::NaoPosActionServer>(options);
+    executor_.add_node(server_);
+    ASSERT_TRUE(client_->wait_for_action_server(5s));
+  }
+
+  // Publishes a sensor sample every 12 ms, as the robot does, and spins until future is ready
+  template<typename FutureT>
+  bool spinUntil(const FutureT & future, std::chrono::seconds timeout = 30s)
+  {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+      if (future.wait_for(0s) == std::future_status::ready) {
+        return true;
+      }
+      tick();
+    }
+    return false;
+  }
+
+  void spinFor(std::chrono::milliseconds duration)
+  {
+    auto deadline = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < deadline) {
+      tick();
+    }
+  }
+
+  rclcpp_action::ClientGoalHandle<PosPlay>::SharedPtr sendGoal(const std::string & name)
+  {
+    PosPlay::Goal goal;
+    goal.action_name = name;
+    auto future = client_->async_send_goal(goal);
+    return spinUntil(future) ? future.get() : nullptr;
+  }
+
+  // Plays name to completion
+  rclcpp_action::ClientGoalHandle<PosPlay>::WrappedResult play(const std::string & name)
+  {
+    auto goal = sendGoal(name);
+    EXPECT_NE(goal, nullptr);
+    if (!goal) {
+      return {};
+    }
+    auto result = client_->async_get_result(goal);
+    EXPECT_TRUE(spinUntil(result));
+    return result.get();
+  }
+
+  static float maxTrackingError(const PosPlay::Result & result)
+  {
+    return *std::max_element(
+      result.max_tracking_error.begin(), result.max_tracking_error.end());
+  }
+
+  rclcpp_action::Client<PosPlay>::SharedPtr client_;
+  std::chrono::milliseconds actuation_delay_{0};
+  std::array<float, JointIndexes::NUMJOINTS> max_step_;  // rad per sample, for every joint
+
+private:
+  void tick()
+  {
+    auto now = std::chrono::steady_clock::now();
+    while (!commands_.empty() && now - commands_.front().first >= actuation_delay_) {
+      const auto & command = *commands_.front().second;
+      for (std::size_t j = 0; j < command.indexes.size(); ++j) {
+        target_[command.indexes[j]] = command.positions[j];
+      }
+      commands_.pop_front();
+    }
+    for (std::size_t j = 0; j < target_.size(); ++j) {
+      sensed_.positions[j] += std::clamp(
+        target_[j] - sensed_.positions[j], -max_step_[j], max_step_[j]);
+    }
+    pub_sensor_->publish(sensed_);
+    executor_.spin_some();
+    std::this_thread::sleep_for(12ms);
+  }
+
+  rclcpp::executors::SingleThreadedExecutor executor_;
+  std::shared_ptr<nao_pos_action_server_ns::NaoPosActionServer> server_;
+  rclcpp::Node::SharedPtr robot_;
+  rclcpp::Publisher<nao_lola_sensor_msgs::msg::JointPositions>::SharedPtr pub_sensor_;
+  rclcpp::Subscription<nao_lola_command_msgs::msg::JointPositions>::SharedPtr sub_command_;
+  std::deque<std::pair<std::chrono::steady_clock::time_point,
+    nao_lola_command_msgs::msg::JointPositions::SharedPtr>> commands_;
+  std::array<float, JointIndexes::NUMJOINTS> target_{};
+  nao_lola_sensor_msgs::msg::JointPositions sensed_;
+};
+
+TEST_F(TestActionServer, TestPlainGoalAfterCanceledScript)
+{
+  startServer();
+  auto script = sendGoal("script/get_up_front");
+  ASSERT_NE(script, nullptr);
+  auto script_result = client_->async_get_result(script);
+
+  // Cancel while the script plays getupFront
+  spinFor(300ms);
+  client_->async_cancel_goal(script);
+  ASSERT_TRUE(spinUntil(script_result));
+  EXPECT_EQ(script_result.get().code, rclcpp_action::ResultCode::CANCELED);
+  // Canceled goals report the ticks played before the cancel
+  EXPECT_GT(script_result.get().result->ticks, 0u);
+
+  // The next goal plays its own motion, not the rest of the canceled script
+  auto stand = sendGoal("stand");
+  ASSERT_NE(stand, nullptr);
+  auto stand_result = client_->async_get_result(stand);
+  ASSERT_TRUE(spinUntil(stand_result));
+  EXPECT_EQ(stand_result.get().code, rclcpp_action::ResultCode::SUCCEEDED);
+  // stand lasts 1 s, getupFront alone 7 s
+  EXPECT_LT(stand_result.get().result->ticks, 200u);
+}
+
+TEST_F(TestActionServer, TestTrackingErrorWithLookAhead)
+{
+  // Commands reach the joints 96 ms after they are published, and the server looks that far ahead
+  actuation_delay_ = 96ms;
+  startServer({rclcpp::Parameter("lookahead.pipeline_latency_ms", 96.0)});
+
+  // stand raises the arms by 90 degrees in 1 s from the zero pose. The joints follow the motion
+  // one tick late, against the command they would lag by the whole look-ahead (about 0.15 rad).
+  auto result = play("stand");
+  ASSERT_EQ(result.code, rclcpp_action::ResultCode::SUCCEEDED);
+  EXPECT_LT(maxTrackingError(*result.result), 0.08f);
+}
+
+TEST_F(TestActionServer, TestLaggingJointSlowsTheTimeline)
+{
+  startServer(
+    {rclcpp::Parameter("tracking.slowdown_error", 0.1),
+      rclcpp::Parameter("tracking.min_time_scale", 0.25)});
+
+  // stand raises LShoulderPitch at about 1.6 rad/s, the joint only follows at 0.8 rad/s
+  max_step_[JointIndexes::LSHOULDERPITCH] = 0.01f;
+  auto result = play("stand");
+  ASSERT_EQ(result.code, rclcpp_action::ResultCode::SUCCEEDED);
+  // The timeline waits for the joint: stand lasts 1 s, about 83 ticks at full speed
+  EXPECT_GT(result.result->ticks, 110u);
+}
+
+TEST_F(TestActionServer, TestStalledJointAbortsTheGoal)
+{
+  startServer(
+    {rclcpp::Parameter("tracking.abort_error", 0.2),
+      rclcpp::Parameter("tracking.abort_ticks", 5)});
+
+  max_step_[JointIndexes::LSHOULDERPITCH] = 0.0f;
+  auto result = play("stand");
+  ASSERT_EQ(result.code, rclcpp_action::ResultCode::ABORTED);
+  EXPECT_FALSE(result.result->success);
+  // The error passes 0.2 rad after about 11 ticks, then grows for 5 more
+  EXPECT_LT(result.result->ticks, 30u);
+  EXPECT_GT(result.result->max_tracking_error[PosPlay::Result::GROUP_LEFT_ARM], 0.2f);
+}
@@ -0,0 +1,150 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <cstdint>
+
+#include "gtest/gtest.h"
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+#include "nao_pos_server/execution_stats.hpp"
+
+using JointIndexes = nao_lola_command_msgs::msg::JointIndexes;
+using stats::ExecutionStats;
+using Result = ExecutionStats::Result;
+using namespace std::chrono_literals;
+
+class TestExecutionStats : public testing::Test
+{
+protected:
+  void SetUp() override {stats_.reset(18ms);}
+
+  // A tick starting period after the previous one and publishing after latency
+  void tick(ExecutionStats::Clock::duration period, ExecutionStats::Clock::duration latency)
+  {
+    now_ += period;
+    stats_.recordTick(now_, now_ + latency);
+  }
+
+  Result result() const
+  {
+    Result result;
+    stats_.fillResult(result);
+    return result;
+  }
+
+  ExecutionStats stats_;
+  ExecutionStats::Clock::time_point now_{};
+};
+
+TEST_F(TestExecutionStats, TestP99BucketEdge)
+{
+  // 100 ticks: the 99th percentile is the 99th fastest tick
+  for (int i = 0; i < 99; ++i) {
+    tick(12ms, 5us);
+  }
+  tick(12ms, 995us);
+  EXPECT_EQ(result().p99_tick_latency_us, 10.0f);
+  EXPECT_EQ(result().max_tick_latency_us, 995.0f);
+
+  // One more slow tick of 101 leaves the 99th fastest in the slow bucket, whose upper edge is
+  // capped by the max
+  tick(12ms, 995us);
+  EXPECT_EQ(result().p99_tick_latency_us, 995.0f);
+}
+
+TEST_F(TestExecutionStats, TestSlowTicksInLastBucket)
+{
+  tick(12ms, 50ms);
+  EXPECT_EQ(result().p99_tick_latency_us, 20000.0f);
+  EXPECT_EQ(result().max_tick_latency_us, 50000.0f);
+}
+
+TEST_F(TestExecutionStats, TestDeadlineMissBoundary)
+{
+  // The first tick has no previous one
+  tick(1s, 5us);
+  // Starting exactly at the deadline is in time
+  tick(18ms, 5us);
+  EXPECT_EQ(result().deadline_misses, 0u);
+  tick(18ms + 1ns, 5us);
+  EXPECT_EQ(result().deadline_misses, 1u);
+  tick(12ms, 5us);
+  EXPECT_EQ(result().deadline_misses, 1u);
+  EXPECT_EQ(result().ticks, 4u);
+}
+
+TEST_F(TestExecutionStats, TestCommandRate)
+{
+  EXPECT_EQ(result().command_rate_hz, 0.0f);
+  tick(12ms, 5us);
+  EXPECT_EQ(result().command_rate_hz, 0.0f);
+  // 10 periods of 10 ms between the first and the last tick
+  for (int i = 0; i < 10; ++i) {
+    tick(10ms, 5us);
+  }
+  EXPECT_FLOAT_EQ(result().command_rate_hz, 100.0f);
+}
+
+TEST_F(TestExecutionStats, TestTrackingErrorPerGroup)
+{
+  const uint8_t joints[] = {
+    JointIndexes::HEADYAW, JointIndexes::LSHOULDERPITCH, JointIndexes::RKNEEPITCH};
+  const float commanded[] = {0.1f, 1.0f, -0.5f};
+  float sensed[JointIndexes::NUMJOINTS] = {};
+
+  sensed[JointIndexes::HEADYAW] = 0.1f;
+  sensed[JointIndexes::LSHOULDERPITCH] = 0.8f;
+  sensed[JointIndexes::RKNEEPITCH] = -0.4f;
+  EXPECT_FLOAT_EQ(stats_.recordTrackingError(joints, 3, commanded, sensed), 0.2f);
+  sensed[JointIndexes::LSHOULDERPITCH] = 0.6f;
+  EXPECT_FLOAT_EQ(stats_.recordTrackingError(joints, 3, commanded, sensed), 0.4f);
+
+  Result r = result();
+  EXPECT_FLOAT_EQ(r.max_tracking_error[Result::GROUP_HEAD], 0.0f);
+  EXPECT_FLOAT_EQ(r.max_tracking_error[Result::GROUP_LEFT_ARM], 0.4f);
+  EXPECT_FLOAT_EQ(r.mean_tracking_error[Result::GROUP_LEFT_ARM], 0.3f);
+  EXPECT_FLOAT_EQ(r.max_tracking_error[Result::GROUP_RIGHT_LEG], 0.1f);
+  EXPECT_FLOAT_EQ(r.mean_tracking_error[Result::GROUP_RIGHT_LEG], 0.1f);
+  // Groups without any joint report nothing
+  EXPECT_EQ(r.max_tracking_error[Result::GROUP_RIGHT_ARM], 0.0f);
+  EXPECT_EQ(r.mean_tracking_error[Result::GROUP_LEFT_LEG], 0.0f);
+}
+
+TEST_F(TestExecutionStats, TestFillResultAfterReset)
+{
+  const uint8_t joints[] = {JointIndexes::HEADYAW};
+  const float commanded[] = {1.0f};
+  float sensed[JointIndexes::NUMJOINTS] = {};
+  tick(12ms, 5us);
+  tick(50ms, 300us);
+  stats_.recordTrackingError(joints, 1, commanded, sensed);
+  stats_.recordPerfCounters({100, 200, 3, 4});
+
+  // Nothing of the previous goal is left, and the new deadline applies
+  stats_.reset(100ms);
+  Result r = result();
+  EXPECT_EQ(r.ticks, 0u);
+  EXPECT_EQ(r.deadline_misses, 0u);
+  EXPECT_EQ(r.command_rate_hz, 0.0f);
+  EXPECT_EQ(r.max_tick_latency_us, 0.0f);
+  EXPECT_EQ(r.p99_tick_latency_us, 0.0f);
+  EXPECT_EQ(r.max_tracking_error[Result::GROUP_HEAD], 0.0f);
+  EXPECT_EQ(r.mean_tracking_error[Result::GROUP_HEAD], 0.0f);
+  EXPECT_EQ(r.mean_tick_cycles, 0.0f);
+
+  tick(12ms, 5us);
+  tick(50ms, 5us);
+  EXPECT_EQ(result().deadline_misses, 0u);
+  EXPECT_EQ(result().ticks, 2u);
+}
@@ -0,0 +1,79 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "nao_pos_server/motion_store.hpp"
+
+// Fields of a csv line
+static std::vector<std::string> fields(const std::string & line)
+{
+  std::vector<std::string> out;
+  std::stringstream ss(line);
+  for (std::string field; std::getline(ss, field, ',');) {
+    out.push_back(field);
+  }
+  return out;
+}
+
+TEST(TestExport, TestExportsTheNamedFileOfAnEmbeddedMotion)
+{
+  ASSERT_NE(motion::MotionStore::findEmbedded("stand"), nullptr);
+
+  // An edited copy of stand.pos turning the head to 45 degrees, in a directory of its own
+  const std::string dir = testing::TempDir() + "export_" + std::to_string(::getpid());
+  ASSERT_EQ(std::system(("mkdir -p " + dir).c_str()), 0);
+  std::ifstream original(std::string(POS_DIR) + "/stand.pos");
+  ASSERT_TRUE(original.is_open());
+  std::ofstream edited(dir + "/stand.pos");
+  for (std::string line; std::getline(original, line);) {
+    if (!line.empty() && line.front() == '!') {
+      line.replace(line.find('0'), 1, "45");
+    }
+    edited << line << "\n";
+  }
+  edited.close();
+
+  const std::string csv = dir + "/stand.csv";
+  ASSERT_EQ(
+    std::system((std::string(NAO_POS_EXPORT) + " " + dir + "/stand.pos --rate 100 --output " +
+    csv).c_str()), 0);
+
+  std::ifstream file(csv);
+  ASSERT_TRUE(file.is_open());
+  std::string header;
+  std::string last;
+  std::getline(file, header);
+  for (std::string line; std::getline(file, line);) {
+    last = line;
+  }
+  auto columns = fields(header);
+  auto values = fields(last);
+  ASSERT_EQ(columns.size(), values.size());
+  ASSERT_EQ(columns.at(1), "HY");
+  // The edited file, not the embedded stand which keeps the head straight
+  EXPECT_NEAR(std::stof(values.at(1)), 45.0f * M_PI / 180.0f, 1e-5f);
+
+  ::unlink(csv.c_str());
+  ::unlink((dir + "/stand.pos").c_str());
+  ::rmdir(dir.c_str());
+}
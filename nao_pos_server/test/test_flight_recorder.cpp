@@ -0,0 +1,187 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "nao_pos_server/flight_recorder.hpp"
+
+using recorder::FlightRecorder;
+using recorder::Kind;
+using recorder::Sample;
+
+// Recorder file private to the test, removed at the end of the scope
+class TempFile
+{
+public:
+  explicit TempFile(const std::string & name)
+  : path_(testing::TempDir() + name + "_" + std::to_string(::getpid()))
+  {
+    ::unlink(path_.c_str());
+  }
+  ~TempFile() {::unlink(path_.c_str());}
+  const std::string & path() const {return path_;}
+
+private:
+  std::string path_;
+};
+
+TEST(TestFlightRecorder, TestRecordsAreReadBackInOrder)
+{
+  TempFile file("recorder_order");
+  auto recorder = FlightRecorder::create(file.path(), 16);
+  ASSERT_NE(recorder, nullptr);
+
+  float sensed[25];
+  for (int j = 0; j < 25; ++j) {
+    sensed[j] = 0.1f * j;
+  }
+  const uint8_t joints[] = {0, 1};
+  const float positions[] = {0.5f, -0.5f};
+  recorder->record(Kind::SensorPositions, 1000, sensed, 25);
+  recorder->record(Kind::CommandPositions, 2000, joints, positions, 2);
+
+  auto samples = recorder->snapshot();
+  ASSERT_EQ(samples.size(), 2u);
+  EXPECT_EQ(samples[0].kind, Kind::SensorPositions);
+  EXPECT_EQ(samples[0].stamp_ns, 1000);
+  EXPECT_EQ(samples[0].numJoints, 25);
+  EXPECT_EQ(samples[0].joints[24], 24);
+  EXPECT_EQ(samples[0].values[24], sensed[24]);
+  EXPECT_EQ(samples[1].kind, Kind::CommandPositions);
+  EXPECT_EQ(samples[1].numJoints, 2);
+  EXPECT_EQ(samples[1].joints[1], 1);
+  EXPECT_EQ(samples[1].values[1], -0.5f);
+
+  // The file holds the same records, without closing the recorder
+  auto fromFile = FlightRecorder::readFile(file.path());
+  ASSERT_TRUE(fromFile.has_value());
+  ASSERT_EQ(fromFile->size(), 2u);
+  EXPECT_EQ((*fromFile)[1].stamp_ns, 2000);
+}
+
+TEST(TestFlightRecorder, TestGoalRecords)
+{
+  TempFile file("recorder_goals");
+  auto recorder = FlightRecorder::create(file.path(), 16);
+  ASSERT_NE(recorder, nullptr);
+
+  recorder->recordGoal(Kind::GoalAccepted, 1000, "script/stand_and_talk", 123456789012345);
+  recorder->recordGoal(Kind::GoalCanceled, 2000, "");
+  recorder->recordGoal(Kind::GoalAccepted, 3000, std::string(300, 'x'));
+
+  auto samples = FlightRecorder::readFile(file.path());
+  ASSERT_TRUE(samples.has_value());
+  ASSERT_EQ(samples->size(), 3u);
+  EXPECT_EQ((*samples)[0].kind, Kind::GoalAccepted);
+  EXPECT_EQ((*samples)[0].goalName(), "script/stand_and_talk");
+  EXPECT_EQ((*samples)[0].goalStartNs(), 123456789012345);
+  EXPECT_EQ((*samples)[1].kind, Kind::GoalCanceled);
+  EXPECT_EQ((*samples)[1].goalName(), "");
+  EXPECT_EQ((*samples)[1].goalStartNs(), 0);
+  EXPECT_EQ((*samples)[2].goalName(), std::string(Sample::MAX_GOAL_NAME, 'x'));
+}
+
+TEST(TestFlightRecorder, TestRingKeepsTheLastRecords)
+{
+  TempFile file("recorder_ring");
+  auto recorder = FlightRecorder::create(file.path(), 8);
+  ASSERT_NE(recorder, nullptr);
+
+  for (int i = 0; i < 20; ++i) {
+    float value = i;
+    recorder->record(Kind::SensorPositions, i, &value, 1);
+  }
+  EXPECT_EQ(recorder->numRecorded(), 20u);
+  auto samples = recorder->snapshot();
+  ASSERT_EQ(samples.size(), 8u);
+  for (std::size_t i = 0; i < samples.size(); ++i) {
+    EXPECT_EQ(samples[i].stamp_ns, static_cast<int64_t>(12 + i));
+    EXPECT_EQ(samples[i].values[0], 12.0f + i);
+  }
+}
+
+TEST(TestFlightRecorder, TestHistoryIsKeptAcrossRestarts)
+{
+  TempFile file("recorder_restart");
+  float value = 1.0f;
+  FlightRecorder::create(file.path(), 8)->record(Kind::SensorPositions, 1, &value, 1);
+  FlightRecorder::create(file.path(), 8)->record(Kind::SensorPositions, 2, &value, 1);
+
+  auto samples = FlightRecorder::readFile(file.path());
+  ASSERT_TRUE(samples.has_value());
+  ASSERT_EQ(samples->size(), 2u);
+  EXPECT_EQ((*samples)[0].stamp_ns, 1);
+  EXPECT_EQ((*samples)[1].stamp_ns, 2);
+
+  // A different capacity starts over
+  FlightRecorder::create(file.path(), 4)->record(Kind::SensorPositions, 3, &value, 1);
+  samples = FlightRecorder::readFile(file.path());
+  ASSERT_TRUE(samples.has_value());
+  ASSERT_EQ(samples->size(), 1u);
+  EXPECT_EQ((*samples)[0].stamp_ns, 3);
+}
+
+TEST(TestFlightRecorder, TestConcurrentWriters)
+{
+  TempFile file("recorder_threads");
+  static constexpr int NUM_THREADS = 4;
+  static constexpr int RECORDS_PER_THREAD = 10000;
+  auto recorder = FlightRecorder::create(file.path(), 1024);
+  ASSERT_NE(recorder, nullptr);
+
+  // Every record carries its thread in each value, a torn record would mix them
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_THREADS; ++t) {
+    threads.emplace_back(
+      [&recorder, t]() {
+        float values[25];
+        std::fill(values, values + 25, static_cast<float>(t));
+        for (int i = 0; i < RECORDS_PER_THREAD; ++i) {
+          recorder->record(Kind::CommandPositions, i, values, 25);
+        }
+      });
+  }
+  for (int i = 0; i < 100; ++i) {
+    for (const auto & sample : recorder->snapshot()) {
+      ASSERT_EQ(sample.numJoints, 25);
+      ASSERT_TRUE(std::all_of(
+          sample.values, sample.values + 25,
+          [&sample](float value) {return value == sample.values[0];}));
+    }
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(recorder->numRecorded(), static_cast<uint64_t>(NUM_THREADS * RECORDS_PER_THREAD));
+  EXPECT_EQ(recorder->snapshot().size(), 1024u);
+}
+
+TEST(TestFlightRecorder, TestInvalidFiles)
+{
+  TempFile file("recorder_invalid");
+  EXPECT_FALSE(FlightRecorder::readFile(file.path()).has_value());
+  std::ofstream(file.path()) << "not a recorder file, but long enough to hold a header.........";
+  EXPECT_FALSE(FlightRecorder::readFile(file.path()).has_value());
+  EXPECT_EQ(FlightRecorder::create(file.path(), 0), nullptr);
+  EXPECT_EQ(FlightRecorder::create("/nonexistent/recorder", 8), nullptr);
+}
@@ -0,0 +1,128 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+#include "nao_pos_server/key_frame_index.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "../src/parser.hpp"
+
+using JointIndexes = nao_lola_command_msgs::msg::JointIndexes;
+using Entries = std::vector<std::pair<std::string, std::shared_ptr<const motion::Motion>>>;
+
+static Entries loadMotions()
+{
+  Entries motions;
+  for (const char * name : {
+      "getupFront", "getupBack", "stand", "sit", "goalieDiveLeft", "goalieDiveRight",
+      "move_head", "d1", "u1", "l1", "r1", "talking"})
+  {
+    std::ifstream file(std::string(POS_DIR) + "/" + name + ".pos");
+    EXPECT_TRUE(file.is_open()) << name;
+    auto lines = parser::readLines(file);
+    motions.emplace_back(name, motion::Motion::fromKeyFrames(parser::parse(lines).keyFrames));
+  }
+  return motions;
+}
+
+// RMS distance between pose and keyframe k of motion, over the joints of the motion
+static float distance(const motion::Motion & motion, std::size_t k, const float * pose)
+{
+  float sum = 0.0f;
+  for (std::size_t j = 0; j < motion.numJoints(); ++j) {
+    const float d = pose[motion.joints()[j]] - motion.positions(k)[j];
+    sum += d * d;
+  }
+  return std::sqrt(sum / motion.numJoints());
+}
+
+TEST(TestKeyFrameIndex, TestKeyFramesAreTheirOwnNearest)
+{
+  auto motions = loadMotions();
+  motion::KeyFrameIndex index(motions);
+
+  std::size_t numKeyFrames = 0;
+  for (const auto & [name, motion] : motions) {
+    numKeyFrames += motion->numKeyFrames();
+    for (std::size_t k = 0; k < motion->numKeyFrames(); ++k) {
+      float pose[JointIndexes::NUMJOINTS] = {};
+      for (std::size_t j = 0; j < motion->numJoints(); ++j) {
+        pose[motion->joints()[j]] = motion->positions(k)[j];
+      }
+      auto match = index.nearest(*motion, pose);
+      ASSERT_TRUE(match.has_value());
+      EXPECT_EQ(match->motion, motion.get());
+      EXPECT_EQ(*match->name, name);
+      EXPECT_EQ(match->distance, 0.0f);
+      // Repeated keyframes may match an earlier copy
+      EXPECT_EQ(distance(*motion, match->keyFrame, pose), 0.0f);
+    }
+  }
+  EXPECT_EQ(index.numKeyFrames(), numKeyFrames);
+}
+
+TEST(TestKeyFrameIndex, TestMatchesExhaustiveSearch)
+{
+  auto motions = loadMotions();
+  motion::KeyFrameIndex index(motions);
+
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> angle(-1.5f, 1.5f);
+  for (int q = 0; q < 200; ++q) {
+    float pose[JointIndexes::NUMJOINTS];
+    for (auto & value : pose) {
+      value = angle(random);
+    }
+
+    float bestOverall = INFINITY;
+    for (const auto & [name, motion] : motions) {
+      float best = INFINITY;
+      for (std::size_t k = 0; k < motion->numKeyFrames(); ++k) {
+        best = std::min(best, distance(*motion, k, pose));
+      }
+      bestOverall = std::min(bestOverall, best);
+
+      auto match = index.nearest(*motion, pose);
+      ASSERT_TRUE(match.has_value());
+      EXPECT_EQ(match->motion, motion.get());
+      EXPECT_FLOAT_EQ(match->distance, best) << name;
+      EXPECT_FLOAT_EQ(distance(*motion, match->keyFrame, pose), best) << name;
+    }
+
+    auto match = index.nearest(pose);
+    ASSERT_TRUE(match.has_value());
+    EXPECT_FLOAT_EQ(match->distance, bestOverall);
+  }
+}
+
+TEST(TestKeyFrameIndex, TestUnknownMotion)
+{
+  motion::KeyFrameIndex index(loadMotions());
+  auto other = motion::Motion::fromKeyFrames(
+    parser::parse({"! 0 0 - - - - - - - - - - - - - - - - - - - - - - - 100"}).keyFrames);
+  float pose[JointIndexes::NUMJOINTS] = {};
+  EXPECT_FALSE(index.nearest(*other, pose).has_value());
+
+  motion::KeyFrameIndex empty({});
+  EXPECT_FALSE(empty.nearest(pose).has_value());
+}
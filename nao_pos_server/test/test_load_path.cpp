@@ -0,0 +1,103 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "nao_pos_server/key_frame.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "../src/parser.hpp"
+
+// Counts every heap allocation of this test binary
+static std::atomic<std::size_t> allocations{0};
+
+void * operator new(std::size_t size)
+{
+  ++allocations;
+  if (void * p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void * p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void * p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+// numKeyFrames head keyframes, HeadYaw going back and forth
+static std::vector<std::string> headMotion(std::size_t numKeyFrames)
+{
+  std::vector<std::string> lines;
+  for (std::size_t k = 0; k < numKeyFrames; ++k) {
+    lines.push_back(
+      std::string("! ") + (k % 2 ? "90" : "0") +
+      " 0 - - - - - - - - - - - - - - - - - - - - - - - 100");
+  }
+  return lines;
+}
+
+static std::size_t parseAllocations(const std::vector<std::string> & lines)
+{
+  std::size_t before = allocations;
+  auto parseResult = parser::parse(lines);
+  std::size_t count = allocations - before;
+  EXPECT_TRUE(parseResult.successful);
+  return count;
+}
+
+TEST(TestLoadPath, TestKeyFramesAreNeverCopied)
+{
+  static_assert(!std::is_copy_constructible<KeyFrame>::value, "KeyFrame must not be copied");
+  static_assert(std::is_nothrow_move_constructible<KeyFrame>::value, "KeyFrame must move");
+}
+
+TEST(TestLoadPath, TestParseAllocationsPerKeyFrame)
+{
+  const std::size_t small = parseAllocations(headMotion(10));
+  const std::size_t large = parseAllocations(headMotion(20));
+
+  // Four vectors per keyframe (position and stiffness indexes and values), each allocated once
+  // and then moved into the keyframe
+  EXPECT_EQ(large - small, 10u * 4u);
+}
+
+TEST(TestLoadPath, TestMotionAllocationsDoNotDependOnSize)
+{
+  auto small = parser::parse(headMotion(10));
+  auto large = parser::parse(headMotion(200));
+
+  std::size_t before = allocations;
+  auto smallMotion = motion::Motion::fromKeyFrames(small.keyFrames);
+  std::size_t smallCount = allocations - before;
+
+  before = allocations;
+  auto largeMotion = motion::Motion::fromKeyFrames(large.keyFrames);
+  std::size_t largeCount = allocations - before;
+
+  EXPECT_EQ(smallCount, largeCount);
+  EXPECT_EQ(largeMotion->numKeyFrames(), 200u);
+}
@@ -0,0 +1,412 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+#include "nao_pos_server/fixed_motion.hpp"
+#include "nao_pos_server/key_frame_pool.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "nao_pos_server/motion_store.hpp"
+#include "../src/embedded_motions.hpp"
+#include "../src/parser.hpp"
+
+using JointIndexes = nao_lola_command_msgs::msg::JointIndexes;
+
+// Head only motion: HeadYaw to 90 degrees in 100ms, hold for 100ms, back to 0 in 200ms
+static const std::vector<std::string> headMotion = {
+  "! 90 0 - - - - - - - - - - - - - - - - - - - - - - - 100",
+  "! 90 0 - - - - - - - - - - - - - - - - - - - - - - - 100",
+  "! 0 0 - - - - - - - - - - - - - - - - - - - - - - - 200",
+};
+
+TEST(TestMotion, TestFromKeyFrames)
+{
+  auto parseResult = parser::parse(headMotion);
+  ASSERT_TRUE(parseResult.successful);
+  auto motion = motion::Motion::fromKeyFrames(parseResult.keyFrames);
+
+  ASSERT_EQ(motion->numKeyFrames(), 3u);
+  ASSERT_EQ(motion->numJoints(), 2u);
+  EXPECT_EQ(motion->joints().at(0), JointIndexes::HEADYAW);
+  EXPECT_EQ(motion->joints().at(1), JointIndexes::HEADPITCH);
+  EXPECT_EQ(motion->timeMs(2), 400u);
+  EXPECT_EQ(motion->durationMs(), 400u);
+  EXPECT_NEAR(motion->positions(1)[0], M_PI / 2, 0.0001);
+  EXPECT_EQ(motion->stiffnesses(1)[0], 1.0);
+}
+
+// Counts the allocations made through it
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+  std::size_t allocations = 0;
+  std::size_t bytesInUse = 0;
+
+private:
+  void * do_allocate(std::size_t bytes, std::size_t alignment) override
+  {
+    ++allocations;
+    bytesInUse += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void * p, std::size_t bytes, std::size_t alignment) override
+  {
+    bytesInUse -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override
+  {
+    return this == &other;
+  }
+};
+
+TEST(TestMotion, TestMotionLivesInOneArena)
+{
+  auto keyFrames = parser::parse(headMotion).keyFrames;
+  CountingResource upstream;
+
+  auto motion = motion::Motion::fromKeyFrames(keyFrames, &upstream);
+  EXPECT_EQ(upstream.allocations, 1u);
+  EXPECT_EQ(motion->timeMs(2), 400u);
+
+  motion.reset();
+  EXPECT_EQ(upstream.bytesInUse, 0u);
+}
+
+TEST(TestMotion, TestEmptyMotionIsFinished)
+{
+  auto motion = motion::Motion::fromKeyFrames({});
+  EXPECT_EQ(motion->numKeyFrames(), 0u);
+  EXPECT_TRUE(motion->finished(0));
+}
+
+TEST(TestMotion, TestSegments)
+{
+  auto motion = motion::Motion::fromKeyFrames(parser::parse(headMotion).keyFrames);
+
+  EXPECT_EQ(motion->segmentAt(0), 0u);
+  EXPECT_EQ(motion->segmentAt(99.9), 0u);
+  EXPECT_EQ(motion->segmentAt(100), 1u);
+  EXPECT_EQ(motion->segmentAt(250), 2u);
+  EXPECT_FALSE(motion->finished(399.9));
+  EXPECT_TRUE(motion->finished(400));
+
+  EXPECT_EQ(motion->segmentFrom(0, 250), 2u);
+  EXPECT_EQ(motion->segmentFrom(2, 250), 2u);
+}
+
+TEST(TestMotion, TestHoldSegments)
+{
+  auto motion = motion::Motion::fromKeyFrames(parser::parse(headMotion).keyFrames);
+
+  EXPECT_FALSE(motion->isHold(0));
+  EXPECT_TRUE(motion->isHold(1));
+  EXPECT_FALSE(motion->isHold(2));
+
+  // Evaluating inside a hold gives the keyframe itself
+  const float start[] = {0.2, 0.4};
+  float positions[2];
+  float stiffnesses[2];
+  motion->evaluate(150, start, positions, stiffnesses);
+  EXPECT_EQ(positions[0], motion->positions(1)[0]);
+  EXPECT_EQ(stiffnesses[0], motion->stiffnesses(1)[0]);
+}
+
+TEST(TestMotion, TestEvaluate)
+{
+  auto motion = motion::Motion::fromKeyFrames(parser::parse(headMotion).keyFrames);
+  const float start[] = {0.2, 0.4};
+  float positions[2];
+  float stiffnesses[2];
+
+  // Starts from the sensed pose
+  motion->evaluate(0, start, positions, stiffnesses);
+  EXPECT_NEAR(positions[0], 0.2, 0.0001);
+  EXPECT_NEAR(positions[1], 0.4, 0.0001);
+  EXPECT_EQ(stiffnesses[0], 1.0);
+
+  motion->evaluate(50, start, positions, stiffnesses);
+  EXPECT_NEAR(positions[0], (0.2 + M_PI / 2) / 2, 0.0001);
+  EXPECT_NEAR(positions[1], 0.2, 0.0001);
+
+  motion->evaluate(150, start, positions, stiffnesses);
+  EXPECT_NEAR(positions[0], M_PI / 2, 0.0001);
+
+  motion->evaluate(300, start, positions, stiffnesses);
+  EXPECT_NEAR(positions[0], M_PI / 4, 0.0001);
+}
+
+TEST(TestMotion, TestEvaluateHoldsLastKeyFrame)
+{
+  auto motion = motion::Motion::fromKeyFrames(parser::parse(headMotion).keyFrames);
+  const float start[] = {0.2, 0.4};
+  float positions[2];
+  float stiffnesses[2];
+
+  EXPECT_EQ(motion->segmentAt(1000), 2u);
+  EXPECT_EQ(motion->segmentFrom(0, 1000), 2u);
+  motion->evaluate(1000, start, positions, stiffnesses);
+  EXPECT_NEAR(positions[0], 0.0, 0.0001);
+  EXPECT_NEAR(positions[1], 0.0, 0.0001);
+}
+
+TEST(TestMotion, TestEvaluateBatchMatchesEvaluate)
+{
+  auto motion = motion::Motion::fromKeyFrames(parser::parse(headMotion).keyFrames);
+  const float start[] = {0.2, 0.4};
+  const std::vector<float> times = {0, 10, 99, 100, 250, 399, 400, 1000, 50};
+
+  std::vector<float> positions(times.size() * 2);
+  std::vector<float> stiffnesses(times.size() * 2);
+  motion->evaluateBatch(
+    times.data(), times.size(), start, positions.data(), stiffnesses.data());
+
+  for (std::size_t i = 0; i < times.size(); ++i) {
+    float expectedPositions[2];
+    float expectedStiffnesses[2];
+    motion->evaluate(times[i], start, expectedPositions, expectedStiffnesses);
+    EXPECT_EQ(positions[i * 2], expectedPositions[0]);
+    EXPECT_EQ(positions[i * 2 + 1], expectedPositions[1]);
+    EXPECT_EQ(stiffnesses[i * 2], expectedStiffnesses[0]);
+  }
+}
+
+TEST(TestMotion, TestFixedMotionMatchesMotion)
+{
+  auto motion = motion::Motion::fromKeyFrames(parser::parse(headMotion).keyFrames);
+  auto fixed = motion::FixedMotion::fromMotion(*motion);
+  ASSERT_EQ(fixed->numKeyFrames(), 3u);
+  EXPECT_EQ(fixed->durationUs(), 400000);
+
+  const float start[] = {0.2, 0.4};
+  const int32_t fixedStart[] = {
+    motion::FixedMotion::toFixed(start[0]), motion::FixedMotion::toFixed(start[1])};
+
+  for (int64_t time_us : {0, 10000, 50000, 99999, 150000, 300000, 400000, 1000000}) {
+    float positions[2];
+    float stiffnesses[2];
+    motion->evaluate(time_us / 1000.0f, start, positions, stiffnesses);
+
+    int32_t fixedPositions[2];
+    int32_t fixedStiffnesses[2];
+    fixed->evaluate(time_us, fixedStart, fixedPositions, fixedStiffnesses);
+
+    EXPECT_NEAR(motion::FixedMotion::toFloat(fixedPositions[0]), positions[0], 1e-6);
+    EXPECT_NEAR(motion::FixedMotion::toFloat(fixedPositions[1]), positions[1], 1e-6);
+    EXPECT_EQ(motion::FixedMotion::toFloat(fixedStiffnesses[0]), stiffnesses[0]);
+  }
+}
+
+TEST(TestMotion, TestFixedMotionIsExact)
+{
+  auto fixed = motion::FixedMotion::fromMotion(
+    *motion::Motion::fromKeyFrames(parser::parse(headMotion).keyFrames));
+  const int32_t start[] = {0, 1 << motion::FixedMotion::FRACTION_BITS};
+  int32_t positions[2];
+  int32_t stiffnesses[2];
+
+  // A quarter of the way from 1.0 to 0.0 (HeadPitch) is exactly 0.75
+  fixed->evaluate(25000, start, positions, stiffnesses);
+  EXPECT_EQ(positions[1], 3 << (motion::FixedMotion::FRACTION_BITS - 2));
+  // Inside the hold, exactly the keyframe
+  fixed->evaluate(150000, start, positions, stiffnesses);
+  EXPECT_EQ(positions[0], fixed->positions(1)[0]);
+}
+
+TEST(TestMotion, TestKeyFramePool)
+{
+  motion::KeyFramePool pool;
+  const float row[] = {0.5f, -1.0f};
+  const float close[] = {0.5f + 0.1f * motion::KeyFramePool::QUANTUM, -1.0f};
+  const float other[] = {0.5f, -0.9f};
+
+  const float * interned = pool.intern(row, 2);
+  EXPECT_NE(interned, row);
+  EXPECT_EQ(interned[1], -1.0f);
+  EXPECT_EQ(pool.intern(close, 2), interned);
+  EXPECT_NE(pool.intern(other, 2), interned);
+  EXPECT_NE(pool.intern(row, 1), interned);
+  EXPECT_EQ(pool.numInterned(), 4u);
+  EXPECT_EQ(pool.numRows(), 3u);
+  EXPECT_EQ(pool.storedValues(), 5u);
+}
+
+TEST(TestMotion, TestPooledMotionsShareRows)
+{
+  auto pool = std::make_shared<motion::KeyFramePool>();
+  auto first = motion::Motion::fromKeyFrames(
+    parser::parse(headMotion).keyFrames, std::pmr::get_default_resource(), pool);
+  auto second = motion::Motion::fromKeyFrames(
+    parser::parse(headMotion).keyFrames, std::pmr::get_default_resource(), pool);
+  auto unpooled = motion::Motion::fromKeyFrames(parser::parse(headMotion).keyFrames);
+
+  // The hold keyframe repeats the first one, every stiffness row is the default one
+  EXPECT_EQ(first->positions(0), first->positions(1));
+  EXPECT_EQ(first->stiffnesses(0), first->stiffnesses(2));
+  EXPECT_EQ(pool->numRows(), 3u);
+  for (std::size_t k = 0; k < first->numKeyFrames(); ++k) {
+    EXPECT_EQ(first->positions(k), second->positions(k));
+    EXPECT_EQ(first->stiffnesses(k), second->stiffnesses(k));
+    EXPECT_EQ(first->isHold(k), unpooled->isHold(k));
+  }
+
+  const float start[] = {0.1f, 0.2f};
+  float pooledPositions[2];
+  float pooledStiffnesses[2];
+  float positions[2];
+  float stiffnesses[2];
+  for (float t = 0.0f; t <= 400.0f; t += 25.0f) {
+    first->evaluate(t, start, pooledPositions, pooledStiffnesses);
+    unpooled->evaluate(t, start, positions, stiffnesses);
+    EXPECT_EQ(pooledPositions[0], positions[0]);
+    EXPECT_EQ(pooledPositions[1], positions[1]);
+    EXPECT_EQ(pooledStiffnesses[0], stiffnesses[0]);
+  }
+
+  // The motions keep the pool alive
+  std::weak_ptr<motion::KeyFramePool> weakPool = pool;
+  pool.reset();
+  EXPECT_FALSE(weakPool.expired());
+  first.reset();
+  second.reset();
+  EXPECT_TRUE(weakPool.expired());
+}
+
+TEST(TestMotion, TestMotionStoreReloadsModifiedFiles)
+{
+  const std::string name = "store_reload_" + std::to_string(::getpid());
+  const std::string path = testing::TempDir() + name + ".pos";
+  auto write = [&path](const std::vector<std::string> & lines) {
+      std::ofstream file(path, std::ios::trunc);
+      for (const auto & line : lines) {
+        file << line << "\n";
+      }
+    };
+
+  write(headMotion);
+  motion::MotionStore store(testing::TempDir());
+  auto first = store.load(name);
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(store.load(name), first);
+  EXPECT_EQ(store.findLoaded(name), first);
+
+  // An edited file is parsed again
+  auto edited = headMotion;
+  edited.push_back(edited.back());
+  write(edited);
+  auto second = store.load(name);
+  ASSERT_NE(second, nullptr);
+  EXPECT_NE(second, first);
+  EXPECT_EQ(second->numKeyFrames(), first->numKeyFrames() + 1);
+  EXPECT_EQ(store.findLoaded(name), second);
+
+  // Evicted motions live until their last user drops them
+  std::weak_ptr<const motion::Motion> evicted = second;
+  store.evict(name);
+  EXPECT_EQ(store.findLoaded(name), nullptr);
+  EXPECT_FALSE(evicted.expired());
+  second.reset();
+  EXPECT_TRUE(evicted.expired());
+  EXPECT_NE(store.load(name), nullptr);
+
+  ::unlink(path.c_str());
+  EXPECT_EQ(store.load(name), nullptr);
+  EXPECT_EQ(store.findLoaded(name), nullptr);
+}
+
+TEST(TestMotion, TestPoolReleasesEvictedRows)
+{
+  auto pool = std::make_shared<motion::KeyFramePool>();
+  auto first = motion::Motion::fromKeyFrames(
+    parser::parse(headMotion).keyFrames, std::pmr::get_default_resource(), pool);
+  auto second = motion::Motion::fromKeyFrames(
+    parser::parse(headMotion).keyFrames, std::pmr::get_default_resource(), pool);
+  const std::size_t values = pool->storedValues();
+
+  // Shared rows stay while a motion uses them
+  first.reset();
+  EXPECT_EQ(pool->storedValues(), values);
+  second.reset();
+  EXPECT_EQ(pool->storedValues(), 0u);
+  EXPECT_EQ(pool->numRows(), 0u);
+}
+
+TEST(TestMotion, TestMotionStorePoolStaysBounded)
+{
+  const std::string name = "store_pool_" + std::to_string(::getpid());
+  const std::string path = testing::TempDir() + name + ".pos";
+  motion::MotionStore store(testing::TempDir());
+
+  // Every edit moves the head elsewhere, so each version has rows of its own. The comment line
+  // changes the size of the file, so the edit is seen even within the mtime resolution.
+  std::size_t values = 0;
+  for (int version = 0; version < 20; ++version) {
+    {
+      std::ofstream file(path, std::ios::trunc);
+      file << std::string(version + 1, '-') << "\n";
+      file << "! " << version << " 0 - - - - - - - - - - - - - - - - - - - - - - - 100\n";
+      file << "! " << version + 1 << " 0 - - - - - - - - - - - - - - - - - - - - - - - 100\n";
+    }
+    if (version % 2 == 0) {
+      store.evict(name);
+    }
+    auto motion = store.load(name);
+    ASSERT_NE(motion, nullptr);
+    EXPECT_NEAR(motion->positions(0)[0], version * M_PI / 180.0, 1e-6);
+    motion.reset();
+    if (version == 0) {
+      values = store.pool().storedValues();
+    }
+    EXPECT_EQ(store.pool().storedValues(), values);
+  }
+
+  store.evict(name);
+  EXPECT_EQ(store.pool().storedValues(), 0u);
+  ::unlink(path.c_str());
+}
+
+TEST(TestMotion, TestEmbeddedMotionsMatchPosFiles)
+{
+  for (const auto * entry = motion::embedded::motions; entry->name; ++entry) {
+    SCOPED_TRACE(entry->name);
+    std::ifstream file(std::string(POS_DIR) + "/" + entry->name + ".pos");
+    ASSERT_TRUE(file.is_open());
+    auto lines = parser::readLines(file);
+    auto parsed = motion::Motion::fromKeyFrames(parser::parse(lines).keyFrames);
+    const motion::Motion & embedded = *entry->motion;
+
+    ASSERT_EQ(embedded.numKeyFrames(), parsed->numKeyFrames());
+    ASSERT_EQ(embedded.numJoints(), parsed->numJoints());
+    for (std::size_t k = 0; k < embedded.numKeyFrames(); ++k) {
+      EXPECT_EQ(embedded.timeMs(k), parsed->timeMs(k));
+      EXPECT_EQ(embedded.isHold(k), parsed->isHold(k));
+      EXPECT_EQ(embedded.support(k), parsed->support(k));
+      for (std::size_t j = 0; j < embedded.numJoints(); ++j) {
+        EXPECT_EQ(embedded.positions(k)[j], parsed->positions(k)[j]);
+        EXPECT_EQ(embedded.stiffnesses(k)[j], parsed->stiffnesses(k)[j]);
+      }
+    }
+  }
+}
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <cmath>
+#include <string>
 
 #include "gtest/gtest.h"
 #include "nao_lola_command_msgs/msg/joint_indexes.hpp"
@@ -163,3 +164,87 @@ TEST(TestParser, TestDuration)
   EXPECT_EQ(parseResult.keyFrames.at(0).t_ms, 300u);
   EXPECT_EQ(parseResult.keyFrames.at(1).t_ms, 600u);
 }
+
+TEST(TestParser, TestTrailingCharactersAreInvalid)
+{
+  std::vector<std::string> testString = {
+    "! 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0x 300",
+  };
+
+  auto parseResult = parser::parse(testString);
+  EXPECT_FALSE(parseResult.successful);
+  ASSERT_FALSE(parseResult.diagnostics.empty());
+  EXPECT_EQ(parseResult.diagnostics.back().line, 1u);
+  EXPECT_EQ(parseResult.diagnostics.back().severity, parser::Diagnostic::Severity::Error);
+}
+
+TEST(TestParser, TestStiffnessWithoutPosition)
+{
+  std::vector<std::string> testString = {
+    "! 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 300",
+    "$ 0 0.2 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0",
+    "",
+  };
+
+  auto parseResult = parser::parse(testString);
+  EXPECT_FALSE(parseResult.successful);
+  ASSERT_FALSE(parseResult.diagnostics.empty());
+  EXPECT_EQ(parseResult.diagnostics.back().line, 2u);
+  EXPECT_EQ(parseResult.diagnostics.back().severity, parser::Diagnostic::Severity::Error);
+}
+
+TEST(TestParser, TestNegativeDuration)
+{
+  std::vector<std::string> testString = {
+    "! 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 -300",
+  };
+
+  auto parseResult = parser::parse(testString);
+  EXPECT_FALSE(parseResult.successful);
+  ASSERT_FALSE(parseResult.diagnostics.empty());
+  // Zero is a valid duration
+  EXPECT_NE(parseResult.diagnostics.back().message.find("non-negative int"), std::string::npos);
+}
+
+TEST(TestParser, TestWarnings)
+{
+  std::vector<std::string> testString = {
+    "Keyframe 1",
+    "! 0 90 - - - - - - - - - - - - - - - - - - - - - - - 300",
+    "Keyframe 2",
+    "! 0 0 - - - - - - - - - - - - - - - - - - - - - - - 0",
+  };
+
+  // Joint limits and zero durations are reported, but do not fail the parsing
+  auto parseResult = parser::parse(testString);
+  EXPECT_TRUE(parseResult.successful);
+  ASSERT_EQ(parseResult.diagnostics.size(), 2u);
+  EXPECT_EQ(parseResult.diagnostics.at(0).line, 2u);
+  EXPECT_EQ(parseResult.diagnostics.at(0).severity, parser::Diagnostic::Severity::Warning);
+  EXPECT_EQ(parseResult.diagnostics.at(1).line, 4u);
+  EXPECT_EQ(parseResult.diagnostics.at(1).severity, parser::Diagnostic::Severity::Warning);
+}
+
+TEST(TestParser, TestSupport)
+{
+  std::vector<std::string> testString = {
+    "! 0 0 - - - - - - - - - - - - - - - - - - - - - - - 300",
+    "@ support double",
+    "! 0 0 - - - - - - - - - - - - - - - - - - - - - - - 300",
+    "! 0 0 - - - - - - - - - - - - - - - - - - - - - - - 300",
+    "@ support left",
+    "! 0 0 - - - - - - - - - - - - - - - - - - - - - - - 300",
+  };
+
+  // A support applies to every following keyframe
+  auto parseResult = parser::parse(testString);
+  ASSERT_TRUE(parseResult.successful);
+  ASSERT_EQ(parseResult.keyFrames.size(), 4u);
+  EXPECT_EQ(parseResult.keyFrames.at(0).support, KeyFrame::Support::None);
+  EXPECT_EQ(parseResult.keyFrames.at(1).support, KeyFrame::Support::Double);
+  EXPECT_EQ(parseResult.keyFrames.at(2).support, KeyFrame::Support::Double);
+  EXPECT_EQ(parseResult.keyFrames.at(3).support, KeyFrame::Support::Left);
+
+  EXPECT_FALSE(parser::parse({"@ support both"}).successful);
+  EXPECT_FALSE(parser::parse({"@ stance left"}).successful);
+}
@@ -0,0 +1,88 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "nao_pos_server/execution_stats.hpp"
+#include "nao_pos_server/perf_counters.hpp"
+
+using stats::PerfCounters;
+
+static constexpr uint64_t NUM_ITERATIONS = 100000;
+
+static PerfCounters::Values countLoop(PerfCounters & counters)
+{
+  counters.start();
+  volatile uint64_t sum = 0;
+  for (uint64_t i = 0; i < NUM_ITERATIONS; ++i) {
+    sum = sum + i;
+  }
+  return counters.stop();
+}
+
+// Machines without a PMU (e.g. virtual machines) run these tests too, and must count nothing
+static void expectPlausible(const PerfCounters & counters, const PerfCounters::Values & values)
+{
+  for (std::size_t c = 0; c < PerfCounters::NUM_COUNTERS; ++c) {
+    if (!counters.available(static_cast<PerfCounters::Counter>(c))) {
+      EXPECT_EQ(values[c], 0u) << c;
+    }
+  }
+  if (counters.available(PerfCounters::INSTRUCTIONS)) {
+    EXPECT_GE(values[PerfCounters::INSTRUCTIONS], NUM_ITERATIONS);
+  }
+  if (counters.available(PerfCounters::CYCLES)) {
+    EXPECT_GT(values[PerfCounters::CYCLES], 0u);
+  }
+}
+
+TEST(TestPerfCounters, TestCountsOrNothing)
+{
+  PerfCounters counters;
+  expectPlausible(counters, countLoop(counters));
+  // stop without start counts nothing
+  EXPECT_EQ(counters.stop(), PerfCounters::Values{});
+}
+
+TEST(TestPerfCounters, TestFollowsTheTickThread)
+{
+  PerfCounters counters;
+  PerfCounters::Values values{};
+  std::thread([&counters, &values]() {values = countLoop(counters);}).join();
+  expectPlausible(counters, values);
+  expectPlausible(counters, countLoop(counters));
+}
+
+TEST(TestPerfCounters, TestMeansInResult)
+{
+  stats::ExecutionStats executionStats;
+  executionStats.reset(std::chrono::milliseconds(18));
+  stats::ExecutionStats::Result result;
+
+  executionStats.fillResult(result);
+  EXPECT_EQ(result.mean_tick_cycles, 0.0f);
+  EXPECT_EQ(result.mean_tick_branch_misses, 0.0f);
+
+  executionStats.recordPerfCounters({100, 200, 3, 4});
+  executionStats.recordPerfCounters({300, 400, 5, 6});
+  executionStats.fillResult(result);
+  EXPECT_EQ(result.mean_tick_cycles, 200.0f);
+  EXPECT_EQ(result.mean_tick_instructions, 300.0f);
+  EXPECT_EQ(result.mean_tick_cache_misses, 4.0f);
+  EXPECT_EQ(result.mean_tick_branch_misses, 5.0f);
+}
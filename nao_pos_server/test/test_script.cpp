@@ -0,0 +1,188 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../src/script.hpp"
+
+// Counts every heap allocation of this test binary
+static std::atomic<std::size_t> allocations{0};
+
+void * operator new(std::size_t size)
+{
+  ++allocations;
+  if (void * p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void * p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void * p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+// Plays every motion for a fixed number of ticks
+class FakePlayer
+{
+public:
+  explicit FakePlayer(int ticksPerMotion)
+  : ticksPerMotion_(ticksPerMotion)
+  {
+    player.start = [this](const std::string & motion) {
+        if (motion == "missing") {
+          return false;
+        }
+        started.push_back(motion);
+        ticksLeft_ = ticksPerMotion_;
+        return true;
+      };
+    player.playing = [this]() {return ticksLeft_ > 0;};
+    player.trackingError = [this]() {return trackingError;};
+  }
+
+  // One playback tick: the script resumes first, then the motion advances
+  bool tick(script::Script & script)
+  {
+    bool running = script.tick();
+    if (ticksLeft_ > 0) {
+      --ticksLeft_;
+    }
+    return running;
+  }
+
+  script::Player player;
+  std::vector<std::string> started;
+  float trackingError = 0.0f;
+
+private:
+  int ticksPerMotion_;
+  int ticksLeft_ = 0;
+};
+
+static script::Script sequence()
+{
+  co_await script::play("sit-to-stand");
+  co_await script::untilConverged(0.05f, 5);
+  co_await script::playLooped("talking", 2);
+}
+
+TEST(TestScript, TestSequenceResumesAtTickGranularity)
+{
+  FakePlayer fake(3);
+  auto script = sequence();
+  script.start(&fake.player);
+
+  // First tick starts the first motion, it lasts 3 ticks
+  EXPECT_TRUE(fake.tick(script));
+  EXPECT_EQ(fake.started, std::vector<std::string>{"sit-to-stand"});
+  EXPECT_TRUE(fake.tick(script));
+  EXPECT_TRUE(fake.tick(script));
+
+  // Converged right away, talking starts at the tick sit-to-stand is over
+  EXPECT_TRUE(fake.tick(script));
+  EXPECT_EQ(fake.started.size(), 2u);
+  EXPECT_EQ(fake.started.back(), "talking");
+
+  int ticks = 0;
+  while (fake.tick(script)) {
+    ++ticks;
+  }
+  EXPECT_FALSE(script.failed());
+  EXPECT_EQ(fake.started.size(), 3u);
+  EXPECT_EQ(ticks, 5);
+}
+
+TEST(TestScript, TestUntilConvergedTimesOut)
+{
+  FakePlayer fake(1);
+  fake.trackingError = 0.2f;
+  auto script = sequence();
+  script.start(&fake.player);
+
+  int ticks = 0;
+  while (fake.tick(script)) {
+    ++ticks;
+  }
+  EXPECT_TRUE(script.failed());
+  EXPECT_EQ(fake.started.size(), 1u);
+}
+
+static script::Script missingMotion()
+{
+  co_await script::play("missing");
+  co_await script::play("stand");
+}
+
+TEST(TestScript, TestMissingMotionFails)
+{
+  FakePlayer fake(1);
+  auto script = missingMotion();
+  script.start(&fake.player);
+
+  EXPECT_FALSE(fake.tick(script));
+  EXPECT_TRUE(script.failed());
+  EXPECT_TRUE(fake.started.empty());
+}
+
+TEST(TestScript, TestTicksDoNotAllocate)
+{
+  // The player of the server only switches to motions prepared with the goal
+  struct
+  {
+    int starts = 0;
+    int ticksLeft = 0;
+  } state;
+  script::Player player;
+  player.start = [&state](const char *) {
+      ++state.starts;
+      state.ticksLeft = 2;
+      return true;
+    };
+  player.playing = [&state]() {return state.ticksLeft > 0;};
+  player.trackingError = []() {return 0.0f;};
+
+  // The coroutine frame is allocated here, when the goal is accepted
+  auto script = script::find("stand_and_talk")->create();
+  script.start(&player);
+
+  std::size_t before = allocations;
+  while (script.tick()) {
+    if (state.ticksLeft > 0) {
+      --state.ticksLeft;
+    }
+  }
+  EXPECT_EQ(allocations - before, 0u);
+  EXPECT_FALSE(script.failed());
+  EXPECT_EQ(state.starts, 4);
+}
+
+TEST(TestScript, TestRegistry)
+{
+  ASSERT_NE(script::find("stand_and_talk"), nullptr);
+  EXPECT_EQ(script::find("stand_and_talk")->motions.size(), 2u);
+  EXPECT_EQ(script::find("no_such_script"), nullptr);
+}
@@ -0,0 +1,149 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "nao_lola_command_msgs/msg/joint_indexes.hpp"
+#include "nao_pos_server/kinematics.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "nao_pos_server/self_collision.hpp"
+#include "../src/embedded_motions.hpp"
+#include "../src/parser.hpp"
+
+using JointIndexes = nao_lola_command_msgs::msg::JointIndexes;
+
+static std::shared_ptr<const motion::Motion> parseMotion(const std::vector<std::string> & lines)
+{
+  auto parseResult = parser::parse(lines);
+  EXPECT_TRUE(parseResult.successful);
+  return motion::Motion::fromKeyFrames(parseResult.keyFrames);
+}
+
+TEST(TestSelfCollision, TestNeutralPoseKinematics)
+{
+  kinematics::Body body;
+  kinematics::forwardKinematics(kinematics::neutralPose(), 1, &body);
+
+  // Legs straight down from the hips
+  EXPECT_NEAR(body.lFoot.position.x, 0.0f, 1e-3f);
+  EXPECT_NEAR(body.lFoot.position.y, 50.0f, 1e-3f);
+  EXPECT_NEAR(body.lFoot.position.z, -85.0f - 100.0f - 102.9f, 1e-3f);
+  EXPECT_NEAR(body.rFoot.position.y, -50.0f, 1e-3f);
+
+  // Arms hanging along the body, mirrored
+  EXPECT_LT(body.lForeArm.position.z, body.lUpperArm.position.z - 100.0f);
+  EXPECT_GT(body.lForeArm.position.y, 98.0f);
+  EXPECT_NEAR(body.lForeArm.position.x, body.rForeArm.position.x, 1e-3f);
+  EXPECT_NEAR(body.lForeArm.position.y, -body.rForeArm.position.y, 1e-3f);
+  EXPECT_NEAR(body.lForeArm.position.z, body.rForeArm.position.z, 1e-3f);
+}
+
+TEST(TestSelfCollision, TestStandIsCollisionFree)
+{
+  std::ifstream file(std::string(POS_DIR) + "/stand.pos");
+  ASSERT_TRUE(file.is_open());
+  auto motion = parseMotion(parser::readLines(file));
+  EXPECT_TRUE(collision::check(*motion).empty());
+}
+
+TEST(TestSelfCollision, TestForeArmAcrossTorso)
+{
+  // Left elbow fully bent with ElbowYaw at 0: the forearm goes through the chest at 500 ms
+  auto motion = parseMotion(
+  {
+    "! - - 90 0 0 -2 - - - - - - - - - - - - - - - - - - - 500",
+    "! - - 90 0 0 -88 - - - - - - - - - - - - - - - - - - - 500",
+    "! - - 90 0 0 -2 - - - - - - - - - - - - - - - - - - - 500",
+  });
+
+  auto contacts = collision::check(*motion);
+  ASSERT_FALSE(contacts.empty());
+  bool torso = false;
+  for (const auto & contact : contacts) {
+    EXPECT_STREQ(contact.arm, "LForeArm");
+    EXPECT_GT(contact.depth_mm, 0.0f);
+    if (std::string(contact.body) == "Torso") {
+      torso = true;
+      EXPECT_LE(contact.start_ms, 1000.0f);
+      EXPECT_GE(contact.end_ms, 1000.0f);
+    }
+  }
+  EXPECT_TRUE(torso);
+  EXPECT_EQ(
+    collision::describe({"LForeArm", "Torso", 900.0f, 1100.0f, 12.5f}),
+    "LForeArm collides with Torso from 900 ms to 1100 ms (12.5 mm deep)");
+}
+
+TEST(TestSelfCollision, TestCollisionBetweenKeyFrames)
+{
+  // Both keyframes are clear of the body, the forearm sweeps through the thigh in between
+  auto motion = parseMotion(
+  {
+    "! - - 90 0 0 -2 - - - - - - - - - - - - - - - - - - - 500",
+    "! - - 60 -18 -90 -88 - - - - - - - - - - - - - - - - - - - 500",
+  });
+
+  auto contacts = collision::check(*motion);
+  ASSERT_EQ(contacts.size(), 1u);
+  EXPECT_STREQ(contacts[0].arm, "LForeArm");
+  EXPECT_STREQ(contacts[0].body, "LThigh");
+  EXPECT_GT(contacts[0].start_ms, 500.0f);
+  EXPECT_LT(contacts[0].end_ms, 1000.0f);
+
+  // Keyframes only: nothing to see
+  EXPECT_TRUE(collision::check(*motion, 1000.0f).empty());
+}
+
+TEST(TestSelfCollision, TestKnownContacts)
+{
+  auto parseResult = parser::parse(
+  {
+    "@ contact LForeArm LThigh",
+    "! - - 90 0 0 -2 - - - - - - - - - - - - - - - - - - - 500",
+    "! - - 60 -18 -90 -88 - - - - - - - - - - - - - - - - - - - 500",
+  });
+  ASSERT_TRUE(parseResult.successful);
+  ASSERT_EQ(parseResult.knownContacts.size(), 1u);
+  auto contacts = collision::check(*motion::Motion::fromKeyFrames(parseResult.keyFrames));
+  ASSERT_EQ(contacts.size(), 1u);
+
+  // Another pair stays reported
+  collision::dropKnown(contacts, {{"LForeArm", "Torso"}});
+  EXPECT_EQ(contacts.size(), 1u);
+  collision::dropKnown(contacts, parseResult.knownContacts);
+  EXPECT_TRUE(contacts.empty());
+
+  EXPECT_FALSE(parser::parse({"@ contact LForeArm"}).successful);
+}
+
+TEST(TestSelfCollision, TestEmbeddedMotionsDeclareTheirContacts)
+{
+  // nao_pos_embed prints these as warnings on every build
+  for (const auto * entry = motion::embedded::motions; entry->name; ++entry) {
+    SCOPED_TRACE(entry->name);
+    std::ifstream file(std::string(POS_DIR) + "/" + entry->name + ".pos");
+    ASSERT_TRUE(file.is_open());
+    auto parseResult = parser::parse(parser::readLines(file));
+    ASSERT_TRUE(parseResult.successful);
+    auto contacts = collision::check(*motion::Motion::fromKeyFrames(parseResult.keyFrames));
+    collision::dropKnown(contacts, parseResult.knownContacts);
+    for (const auto & contact : contacts) {
+      ADD_FAILURE() << collision::describe(contact);
+    }
+  }
+}
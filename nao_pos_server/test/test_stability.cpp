@@ -0,0 +1,120 @@
+// Copyright 2024 Antonio Bono
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "nao_pos_server/kinematics.hpp"
+#include "nao_pos_server/motion.hpp"
+#include "nao_pos_server/stability.hpp"
+#include "../src/parser.hpp"
+
+static std::shared_ptr<const motion::Motion> parseMotion(const std::vector<std::string> & lines)
+{
+  auto parseResult = parser::parse(lines);
+  EXPECT_TRUE(parseResult.successful);
+  return motion::Motion::fromKeyFrames(parseResult.keyFrames);
+}
+
+TEST(TestStability, TestNeutralPoseCenterOfMass)
+{
+  kinematics::Body body;
+  kinematics::forwardKinematics(kinematics::neutralPose(), 1, &body);
+  auto com = kinematics::centerOfMass(body);
+
+  // Centered, a bit below the torso origin
+  EXPECT_NEAR(com.x, 0.0f, 5.0f);
+  EXPECT_NEAR(com.y, 0.0f, 1e-3f);
+  EXPECT_LT(com.z, 0.0f);
+  EXPECT_GT(com.z, -100.0f);
+}
+
+TEST(TestStability, TestUndeclaredSupportIsSkipped)
+{
+  auto motion = parseMotion(
+  {
+    "! - - - - - - - - - - - - - - - - - - - - - - - - - 500",
+    "! - - - - - - - - - - - - - - - - - - - - - - - - - 500",
+  });
+  EXPECT_TRUE(stability::analyze(*motion).empty());
+}
+
+TEST(TestStability, TestDoubleSupport)
+{
+  // Slow squat and back
+  auto motion = parseMotion(
+  {
+    "@ support double",
+    "! - - - - - - - 0 0 0 0 0 0 0 0 0 0 0 - - - - - - - 500",
+    "! - - - - - - - 0 0 -40 80 -40 0 0 -40 80 -40 0 - - - - - - - 1000",
+    "! - - - - - - - 0 0 0 0 0 0 0 0 0 0 0 - - - - - - - 1000",
+  });
+
+  auto segments = stability::analyze(*motion);
+  ASSERT_EQ(segments.size(), 2u);
+  for (const auto & segment : segments) {
+    EXPECT_EQ(segment.support, KeyFrame::Support::Double);
+    EXPECT_EQ(segment.duration_ms, 1000u);
+    EXPECT_GT(segment.margin_mm, 20.0f);
+    EXPECT_LT(segment.min_duration_ms, 1000u);
+    EXPECT_TRUE(segment.stable());
+  }
+  EXPECT_EQ(segments[0].segment, 1u);
+  EXPECT_EQ(segments[1].segment, 2u);
+}
+
+TEST(TestStability, TestSingleSupportWithoutShiftingWeight)
+{
+  // Standing straight, the center of mass is between the feet, out of the left sole
+  auto motion = parseMotion(
+  {
+    "@ support left",
+    "! - - - - - - - 0 0 0 0 0 0 0 0 0 0 0 - - - - - - - 500",
+    "! - - - - - - - 0 0 0 0 0 0 0 0 0 0 0 - - - - - - - 500",
+  });
+
+  auto segments = stability::analyze(*motion);
+  ASSERT_EQ(segments.size(), 1u);
+  EXPECT_LT(segments[0].margin_mm, 0.0f);
+  EXPECT_EQ(segments[0].unstable_from_ms, 500.0f);
+  EXPECT_EQ(segments[0].unstable_to_ms, 1000.0f);
+  EXPECT_EQ(segments[0].min_duration_ms, stability::Segment::NEVER);
+  EXPECT_FALSE(segments[0].stable());
+  EXPECT_EQ(
+    stability::describe(segments[0]).rfind("segment 1 (left support): CoM outside", 0), 0u);
+}
+
+TEST(TestStability, TestFastSegmentIsUnstable)
+{
+  // Leaning the torso forward over the ankles needs time
+  std::vector<std::string> lines = {
+    "@ support double",
+    "! - - - - - - - 0 0 0 0 0 0 0 0 0 0 0 - - - - - - - 500",
+    "! - - - - - - - 0 0 -60 0 30 0 0 -60 0 30 0 - - - - - - - 10",
+  };
+
+  auto segments = stability::analyze(*parseMotion(lines));
+  ASSERT_EQ(segments.size(), 1u);
+  EXPECT_GE(segments[0].margin_mm, 0.0f);
+  EXPECT_GT(segments[0].min_duration_ms, 30u);
+  EXPECT_FALSE(segments[0].stable());
+
+  // Same pose, slower
+  lines.back().replace(lines.back().size() - 2, 2, "500");
+  segments = stability::analyze(*parseMotion(lines));
+  ASSERT_EQ(segments.size(), 1u);
+  EXPECT_TRUE(segments[0].stable());
+}